@@ -0,0 +1,133 @@
+#ifndef COMMAND_REGISTRY_H
+#define COMMAND_REGISTRY_H
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#include <packet_control_interface.h>
+
+/* Data length for packets whose handlers validate the length themselves */
+#define VARIABLE_DATA_LENGTH 0xFF
+
+/* Largest data length of a received packet, longer packets are reassembled from fragments */
+#define MAXIMUM_DATA_LENGTH FRAGMENT_BUFFER_LENGTH
+
+/* Size of a bitmap with one bit per type id */
+#define TYPE_BITMAP_SIZE 32
+
+/*
+ * An entry of a command table, stored in flash. The handler is only called
+ * if the data length of the packet matches DataLength.
+ */
+template<class CLASS>
+struct SCommand {
+   CPacketControlInterface::CPacket::EType Type;
+   uint8_t DataLength;
+   void (CLASS::*Handler)(const CPacketControlInterface::CPacket& c_packet);
+};
+
+/* compile time sequence of the type ids 0 to 255 */
+template<uint8_t... UN_TYPE_IDS>
+struct STypeIdSequence {};
+
+template<uint16_t UN_COUNT, uint8_t... UN_TYPE_IDS>
+struct SMakeTypeIdSequence : SMakeTypeIdSequence<UN_COUNT - 1, UN_COUNT - 1, UN_TYPE_IDS...> {};
+
+template<uint8_t... UN_TYPE_IDS>
+struct SMakeTypeIdSequence<0, UN_TYPE_IDS...> {
+   using Type = STypeIdSequence<UN_TYPE_IDS...>;
+};
+
+/* table in flash from the type id to the position of its command */
+template<class REGISTRY, class SEQUENCE>
+struct SCommandIndex;
+
+template<class REGISTRY, uint8_t... UN_TYPE_IDS>
+struct SCommandIndex<REGISTRY, STypeIdSequence<UN_TYPE_IDS...>> {
+   static const uint8_t Table[sizeof...(UN_TYPE_IDS)];
+};
+
+template<class REGISTRY, uint8_t... UN_TYPE_IDS>
+const uint8_t SCommandIndex<REGISTRY, STypeIdSequence<UN_TYPE_IDS...>>::Table[sizeof...(UN_TYPE_IDS)] PROGMEM = {
+   REGISTRY::Find(UN_TYPE_IDS, 0)...
+};
+
+/*
+ * Dispatches packets to the handlers of CLASS listed in TABLE::Commands, a
+ * constexpr array of SCommand<CLASS> stored in flash. The index table, built
+ * at compile time from TABLE::Commands, holds the position of the command for
+ * each type id so that the dispatch is a single lookup.
+ */
+template<class CLASS, class TABLE>
+class CCommandRegistry {
+
+public:
+   /* Returns false if the packet type is unknown or its data length is invalid */
+   static bool Dispatch(CLASS& c_instance, const CPacketControlInterface::CPacket& c_packet) {
+      static_assert(COMMAND_COUNT < NO_COMMAND,
+                    "too many commands in the table");
+      static_assert(HasUniqueTypes(0),
+                    "a packet type is listed more than once in the table");
+      static_assert(HasValidDataLengths(0),
+                    "a data length in the table is longer than any received packet");
+
+      uint8_t unIndex = pgm_read_byte(&TIndex::Table[static_cast<uint8_t>(c_packet.GetType())]);
+      if(unIndex == NO_COMMAND) {
+         return false;
+      }
+      const SCommand<CLASS>* psCommand = &TABLE::Commands[unIndex];
+      uint8_t unDataLength = pgm_read_byte(&psCommand->DataLength);
+      if(unDataLength != VARIABLE_DATA_LENGTH && unDataLength != c_packet.GetDataLength()) {
+         return false;
+      }
+      void (CLASS::*fnHandler)(const CPacketControlInterface::CPacket&);
+      memcpy_P(&fnHandler, &psCommand->Handler, sizeof(fnHandler));
+      (c_instance.*fnHandler)(c_packet);
+      return true;
+   }
+
+   /* Sets bit (id % 8) of byte (id / 8) in pun_bitmap for each type id in the table */
+   static void GetTypeBitmap(uint8_t* pun_bitmap) {
+      for(uint8_t unByte = 0; unByte < TYPE_BITMAP_SIZE; unByte++) {
+         uint8_t unBits = 0;
+         for(uint8_t unBit = 0; unBit < 8; unBit++) {
+            if(pgm_read_byte(&TIndex::Table[unByte * 8 + unBit]) != NO_COMMAND) {
+               unBits |= (1 << unBit);
+            }
+         }
+         pun_bitmap[unByte] = unBits;
+      }
+   }
+
+private:
+   using TIndex = SCommandIndex<CCommandRegistry, typename SMakeTypeIdSequence<256>::Type>;
+
+   friend TIndex;
+
+   static constexpr uint8_t NO_COMMAND = 0xFF;
+
+   static constexpr uint8_t COMMAND_COUNT =
+      sizeof(TABLE::Commands) / sizeof(TABLE::Commands[0]);
+
+   /* position of the command for un_type_id in TABLE::Commands, or NO_COMMAND */
+   static constexpr uint8_t Find(uint8_t un_type_id, uint8_t un_index) {
+      return (un_index == COMMAND_COUNT) ? NO_COMMAND :
+         (static_cast<uint8_t>(TABLE::Commands[un_index].Type) == un_type_id) ?
+            un_index : Find(un_type_id, un_index + 1);
+   }
+
+   static constexpr bool HasUniqueTypes(uint8_t un_index) {
+      return (un_index == COMMAND_COUNT) ||
+         ((Find(static_cast<uint8_t>(TABLE::Commands[un_index].Type), 0) == un_index) &&
+          HasUniqueTypes(un_index + 1));
+   }
+
+   static constexpr bool HasValidDataLengths(uint8_t un_index) {
+      return (un_index == COMMAND_COUNT) ||
+         (((TABLE::Commands[un_index].DataLength == VARIABLE_DATA_LENGTH) ||
+           (TABLE::Commands[un_index].DataLength <= MAXIMUM_DATA_LENGTH)) &&
+          HasValidDataLengths(un_index + 1));
+   }
+};
+
+#endif
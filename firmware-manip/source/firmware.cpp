@@ -6,7 +6,7 @@
 /***********************************************************/
 /***********************************************************/
 
-#define REPLY_BUFFER_LENGTH 8
+#define REPLY_BUFFER_LENGTH 32
 #define I2C_TX_DATA_LENGTH 8
 
 /***********************************************************/
@@ -18,22 +18,6 @@ CFirmware CFirmware::_firmware;
 /* main function that runs the firmware */
 int main(void)
 {
-   /* FILE structs for fprintf */
-   FILE huart;
-
-   /* Set up FILE structs for fprintf */                           
-   fdev_setup_stream(&huart, 
-                     [](char c_to_write, FILE* pf_stream) {
-                        CFirmware::GetInstance().GetHUARTController().Write(c_to_write);
-                        return 1;
-                     },
-                     [](FILE* pf_stream) {
-                        return int(CFirmware::GetInstance().GetHUARTController().Read());
-                     },
-                     _FDEV_SETUP_RW);
-
-   CFirmware::GetInstance().SetFilePointer(&huart);
-
    /* Execute the firmware */
    CFirmware::GetInstance().Exec();
    /* Shutdown */
@@ -58,9 +42,6 @@ void CFirmware::Exec() {
       m_cNFCController.Probe() &&
       m_cNFCController.ConfigureSAM() && 
       m_cNFCController.PowerDown();
-
-   uint8_t punReplyBuffer[REPLY_BUFFER_LENGTH];
-   uint8_t unRxBufferCount;
       
    for(;;) {
       /* step the lift actuator system state machine */
@@ -68,236 +49,583 @@ void CFirmware::Exec() {
       /* check the PCI for input */
       m_cPacketControlInterface.ProcessInput();
       if(m_cPacketControlInterface.GetState() == CPacketControlInterface::EState::RECV_COMMAND) {
-         CPacketControlInterface::CPacket cPacket = m_cPacketControlInterface.GetPacket();
-         switch(cPacket.GetType()) {
-         case CPacketControlInterface::CPacket::EType::GET_UPTIME:
-            if(cPacket.GetDataLength() == 0) {
-               uint32_t unUptime = m_cTimer.GetMilliseconds();
-               uint8_t punTxData[] = {
-                  uint8_t((unUptime >> 24) & 0xFF),
-                  uint8_t((unUptime >> 16) & 0xFF),
-                  uint8_t((unUptime >> 8 ) & 0xFF),
-                  uint8_t((unUptime >> 0 ) & 0xFF)
-               };
-               m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_UPTIME,
-                                                    punTxData,
-                                                    4);
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::GET_BATT_LVL:
-            if(cPacket.GetDataLength() == 0) {
-               uint8_t unBattLevel = CADCController::GetInstance().GetValue(CADCController::EChannel::ADC6);
-               m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_BATT_LVL,
-                                                    &unBattLevel,
-                                                    1);
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::GET_CHARGER_STATUS:
-            if(cPacket.GetDataLength() == 0) {
-               uint8_t punTxData[] {
-                  uint8_t((PINC & PWR_MON_PGOOD) ? 0x00 : 0x01),
-                  uint8_t((PINC & PWR_MON_CHG) ? 0x00 : 0x01)
-               };
-               m_cPacketControlInterface.SendPacket(
-                  CPacketControlInterface::CPacket::EType::GET_CHARGER_STATUS,
-                  punTxData,
-                  sizeof(punTxData));
-            }
-            break;            
-         case CPacketControlInterface::CPacket::EType::SET_LIFT_ACTUATOR_POSITION:
-            /* Set the speed of the stepper motor */
-            if(cPacket.GetDataLength() == 1) {
-               const uint8_t* punRxData = cPacket.GetDataPointer();
-               m_cLiftActuatorSystem.SetPosition(punRxData[0]);
-               m_cLiftActuatorSystem.ProcessEvent(CLiftActuatorSystem::ESystemEvent::START_POSITION_CTRL);
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::SET_LIFT_ACTUATOR_SPEED:
-            /* Set the speed of the stepper motor */
-            if(cPacket.GetDataLength() == 1) {
-               const uint8_t* punRxData = cPacket.GetDataPointer();
-               int8_t nSpeed = reinterpret_cast<const int8_t&>(punRxData[0]);
-               m_cLiftActuatorSystem.SetSpeed(nSpeed);
-               m_cLiftActuatorSystem.ProcessEvent(CLiftActuatorSystem::ESystemEvent::START_SPEED_CTRL);
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::CALIBRATE_LIFT_ACTUATOR:
-            if(cPacket.GetDataLength() == 0) {
-               m_cLiftActuatorSystem.ProcessEvent(CLiftActuatorSystem::ESystemEvent::START_CALIBRATION);
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::EMER_STOP_LIFT_ACTUATOR:
-            if(cPacket.GetDataLength() == 0) {
-               m_cLiftActuatorSystem.ProcessEvent(CLiftActuatorSystem::ESystemEvent::STOP);
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::GET_LIFT_ACTUATOR_POSITION:
-            /* Set the speed of the stepper motor */
-            if(cPacket.GetDataLength() == 0) {
-               m_cPacketControlInterface.SendPacket(
-                  CPacketControlInterface::CPacket::EType::GET_LIFT_ACTUATOR_POSITION,
-                  m_cLiftActuatorSystem.GetPosition());
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::GET_LIFT_ACTUATOR_STATE:
-            /* Set the speed of the stepper motor */
-            if(cPacket.GetDataLength() == 0) {
-               m_cPacketControlInterface.SendPacket(
-                  CPacketControlInterface::CPacket::EType::GET_LIFT_ACTUATOR_STATE,
-                  static_cast<uint8_t>(m_cLiftActuatorSystem.GetSystemState()));
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::GET_LIMIT_SWITCH_STATE:
-            if(cPacket.GetDataLength() == 0) {
-               uint8_t punTxData[] {
-                  uint8_t(m_cLiftActuatorSystem.GetUpperLimitSwitchState() ? 0x01 : 0x00),
-                  uint8_t(m_cLiftActuatorSystem.GetLowerLimitSwitchState() ? 0x01 : 0x00)
-               };
-               m_cPacketControlInterface.SendPacket(
-                  CPacketControlInterface::CPacket::EType::GET_LIMIT_SWITCH_STATE,
-                  punTxData,
-                  sizeof(punTxData));
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::SET_EM_CHARGE_ENABLE:
-            if(cPacket.GetDataLength() == 1) {
-               const uint8_t* punRxData = cPacket.GetDataPointer();
-               if(punRxData[0] != 0) {
-                  m_cLiftActuatorSystem.GetElectromagnetController().SetChargeEnable(true);
-               } 
-               else {
-                  m_cLiftActuatorSystem.GetElectromagnetController().SetChargeEnable(false);
-               }
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::SET_EM_DISCHARGE_MODE:
-            if(cPacket.GetDataLength() == 1) {
-               const uint8_t* punRxData = cPacket.GetDataPointer();
-               switch(punRxData[0]) {
-               case 0: 
-                  m_cLiftActuatorSystem.GetElectromagnetController().SetDischargeMode(
-                     CElectromagnetController::EDischargeMode::CONSTRUCTIVE);
-                  break;
-               case 1: 
-                  m_cLiftActuatorSystem.GetElectromagnetController().SetDischargeMode(
-                     CElectromagnetController::EDischargeMode::DESTRUCTIVE);
-                  break;
-               default:
-                  m_cLiftActuatorSystem.GetElectromagnetController().SetDischargeMode(
-                     CElectromagnetController::EDischargeMode::DISABLE);
-                  break;
-               }
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::GET_EM_ACCUM_VOLTAGE:
-            if(cPacket.GetDataLength() == 0) {
-               uint8_t unAccumulatedVoltage = 
-                  m_cLiftActuatorSystem.GetElectromagnetController().GetAccumulatedVoltage();
-               m_cPacketControlInterface.SendPacket(
-                  CPacketControlInterface::CPacket::EType::GET_EM_ACCUM_VOLTAGE,
-                  &unAccumulatedVoltage,
-                  1);
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::READ_SMBUS_BYTE:
-            if(cPacket.GetDataLength() == 1) {
-               uint8_t unAddress = cPacket.GetDataPointer()[0];
-               m_cTWController.Read(unAddress, 1, true);
-               punReplyBuffer[0] = m_cTWController.Read();
-               m_cPacketControlInterface.SendPacket(
-                  CPacketControlInterface::CPacket::EType::READ_SMBUS_BYTE,
-                  punReplyBuffer,
-                  1);
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::WRITE_SMBUS_BYTE:
-            if(cPacket.GetDataLength() == 2) {
-               uint8_t unAddress = cPacket.GetDataPointer()[0];
-               uint8_t unData = cPacket.GetDataPointer()[1];
-               m_cTWController.BeginTransmission(unAddress);    
-               m_cTWController.Write(unData);
-               m_cTWController.EndTransmission(true);
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::READ_SMBUS_BYTE_DATA:
-            if(cPacket.GetDataLength() == 2) {
-               uint8_t unAddress = cPacket.GetDataPointer()[0];
-               uint8_t unRegister = cPacket.GetDataPointer()[1];
-               m_cTWController.BeginTransmission(unAddress);    
-               m_cTWController.Write(unRegister);
-               m_cTWController.EndTransmission(false);
-               m_cTWController.Read(unAddress, 1, true);
-               punReplyBuffer[0] = m_cTWController.Read();
-               m_cPacketControlInterface.SendPacket(
-                  CPacketControlInterface::CPacket::EType::READ_SMBUS_BYTE_DATA,
-                  punReplyBuffer,
-                  1);
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::WRITE_SMBUS_BYTE_DATA:
-            if(cPacket.GetDataLength() == 3) {
-               uint8_t unAddress = cPacket.GetDataPointer()[0];
-               uint8_t unRegister = cPacket.GetDataPointer()[1];
-               uint8_t unData = cPacket.GetDataPointer()[2];
-               m_cTWController.BeginTransmission(unAddress);
-               m_cTWController.Write(unRegister);
-               m_cTWController.Write(unData);
-               m_cTWController.EndTransmission(true);
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::READ_SMBUS_WORD_DATA:
-            if(cPacket.GetDataLength() == 2) {
-               uint8_t unAddress = cPacket.GetDataPointer()[0];
-               uint8_t unRegister = cPacket.GetDataPointer()[1];
-               m_cTWController.BeginTransmission(unAddress);  
-               m_cTWController.Write(unRegister);
-               m_cTWController.EndTransmission(false);
-               m_cTWController.Read(unAddress, 2, true);
-               punReplyBuffer[0] = m_cTWController.Read();
-               punReplyBuffer[1] = m_cTWController.Read();
-               m_cPacketControlInterface.SendPacket(
-                  CPacketControlInterface::CPacket::EType::READ_SMBUS_WORD_DATA,
-                  punReplyBuffer,
-                  2);
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::READ_SMBUS_I2C_BLOCK_DATA:
-            if(cPacket.GetDataLength() == 3) {
-               uint8_t unAddress = cPacket.GetDataPointer()[0];
-               uint8_t unRegister = cPacket.GetDataPointer()[1];
-               uint8_t unCount = cPacket.GetDataPointer()[2];
-               m_cTWController.BeginTransmission(unAddress);
-               m_cTWController.Write(unRegister);
-               m_cTWController.EndTransmission(false);
-               m_cTWController.Read(unAddress, unCount, true);
-               for(uint8_t unIndex = 0; unIndex < unCount; unIndex++) {
-                  punReplyBuffer[unIndex] = m_cTWController.Read();
-               }
-               m_cPacketControlInterface.SendPacket(
-                  CPacketControlInterface::CPacket::EType::READ_SMBUS_I2C_BLOCK_DATA,
-                  punReplyBuffer,
-                  unCount);
-            }
-            break;
-
-         case CPacketControlInterface::CPacket::EType::WRITE_NFC:
-            if(cPacket.HasData()) {
-               if(m_cNFCController.P2PInitiatorInit()) {
-                  unRxBufferCount = 
-                     m_cNFCController.P2PInitiatorTxRx(cPacket.GetDataPointer(),
-                                                       cPacket.GetDataLength(),
-                                                       punReplyBuffer,
-                                                       REPLY_BUFFER_LENGTH);
-               }
-               m_cNFCController.PowerDown();
-            }
-            break;
-         default:            
-            break;
-         }
+         ExecutePacket(m_cPacketControlInterface.GetPacket());
+      }
+      /* Generate the requests of the subscriptions that are due */
+      CPacketControlInterface::CPacket cSubscriptionPacket(0xFF, 0, nullptr);
+      if(m_cPacketControlInterface.GetDueSubscription(m_cTimer.GetMilliseconds(), cSubscriptionPacket)) {
+         ExecutePacket(cSubscriptionPacket);
+      }
+      /* Execute the scheduled command that is due */
+      CPacketControlInterface::CPacket cScheduledPacket(0xFF, 0, nullptr);
+      if(m_cPacketControlInterface.GetDueCommand(m_cTimer.GetMicroseconds(), cScheduledPacket)) {
+         ExecutePacket(cScheduledPacket);
+      }
+      /* Restore the previous baud rate if the host did not follow a change */
+      m_cPacketControlInterface.CheckBaudRate(m_cTimer.GetMilliseconds());
+      /* Report the state changes and send the posted events */
+      PostStateChanges();
+      m_cPacketControlInterface.SendEvents(m_cTimer.GetMilliseconds());
+      /* Send the log while the link is idle */
+      m_cPacketControlInterface.SendLog(CLog::GetInstance());
+      /* Sleep until an interrupt signals work, scheduled commands are polled so that
+         they are executed at their time and not at the next timer tick */
+      if(!m_cPacketControlInterface.HasScheduledCommands()) {
+         CPendingWork::GetInstance().Wait();
+      }
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+/* Packet handlers and the data length they expect, sorted by type id */
+struct CFirmware::SCommandTable {
+   static constexpr SCommand<CFirmware> Commands[] PROGMEM = {
+      {CPacketControlInterface::CPacket::EType::GET_UPTIME, 0, &CFirmware::HandleGetUptime},
+      {CPacketControlInterface::CPacket::EType::GET_BATT_LVL, 0, &CFirmware::HandleGetBattLvl},
+      {CPacketControlInterface::CPacket::EType::GET_CHARGER_STATUS, 0, &CFirmware::HandleGetChargerStatus},
+      {CPacketControlInterface::CPacket::EType::SET_LIFT_ACTUATOR_POSITION, 1, &CFirmware::HandleSetLiftActuatorPosition},
+      {CPacketControlInterface::CPacket::EType::GET_LIFT_ACTUATOR_POSITION, 0, &CFirmware::HandleGetLiftActuatorPosition},
+      {CPacketControlInterface::CPacket::EType::SET_LIFT_ACTUATOR_SPEED, 1, &CFirmware::HandleSetLiftActuatorSpeed},
+      {CPacketControlInterface::CPacket::EType::GET_LIMIT_SWITCH_STATE, 0, &CFirmware::HandleGetLimitSwitchState},
+      {CPacketControlInterface::CPacket::EType::CALIBRATE_LIFT_ACTUATOR, 0, &CFirmware::HandleCalibrateLiftActuator},
+      {CPacketControlInterface::CPacket::EType::EMER_STOP_LIFT_ACTUATOR, 0, &CFirmware::HandleEmerStopLiftActuator},
+      {CPacketControlInterface::CPacket::EType::GET_LIFT_ACTUATOR_STATE, 0, &CFirmware::HandleGetLiftActuatorState},
+      {CPacketControlInterface::CPacket::EType::SET_EM_CHARGE_ENABLE, 1, &CFirmware::HandleSetEMChargeEnable},
+      {CPacketControlInterface::CPacket::EType::SET_EM_DISCHARGE_MODE, 1, &CFirmware::HandleSetEMDischargeMode},
+      {CPacketControlInterface::CPacket::EType::GET_EM_ACCUM_VOLTAGE, 0, &CFirmware::HandleGetEMAccumVoltage},
+      {CPacketControlInterface::CPacket::EType::WRITE_NFC, VARIABLE_DATA_LENGTH, &CFirmware::HandleWriteNFC},
+      {CPacketControlInterface::CPacket::EType::READ_SMBUS_BYTE, 1, &CFirmware::HandleReadSMBusByte},
+      {CPacketControlInterface::CPacket::EType::READ_SMBUS_BYTE_DATA, 2, &CFirmware::HandleReadSMBusByteData},
+      {CPacketControlInterface::CPacket::EType::READ_SMBUS_WORD_DATA, 2, &CFirmware::HandleReadSMBusWordData},
+      {CPacketControlInterface::CPacket::EType::READ_SMBUS_I2C_BLOCK_DATA, 3, &CFirmware::HandleReadSMBusI2CBlockData},
+      {CPacketControlInterface::CPacket::EType::WRITE_SMBUS_BYTE, 2, &CFirmware::HandleWriteSMBusByte},
+      {CPacketControlInterface::CPacket::EType::WRITE_SMBUS_BYTE_DATA, 3, &CFirmware::HandleWriteSMBusByteData},
+      {CPacketControlInterface::CPacket::EType::BATCH, VARIABLE_DATA_LENGTH, &CFirmware::HandleBatch},
+      {CPacketControlInterface::CPacket::EType::SET_SUBSCRIPTION, 3, &CFirmware::HandleSetSubscription},
+      {CPacketControlInterface::CPacket::EType::SET_LINK_OPTIONS, 1, &CFirmware::HandleSetLinkOptions},
+      {CPacketControlInterface::CPacket::EType::SET_BAUD_RATE, 4, &CFirmware::HandleSetBaudRate},
+      {CPacketControlInterface::CPacket::EType::GET_LINK_STATS, VARIABLE_DATA_LENGTH, &CFirmware::HandleGetLinkStats},
+      {CPacketControlInterface::CPacket::EType::PING, VARIABLE_DATA_LENGTH, &CFirmware::HandlePing},
+      {CPacketControlInterface::CPacket::EType::SCHEDULE_COMMAND, VARIABLE_DATA_LENGTH, &CFirmware::HandleScheduleCommand},
+      {CPacketControlInterface::CPacket::EType::ACK_EVENT, 2, &CFirmware::HandleAckEvent},
+      {CPacketControlInterface::CPacket::EType::GET_CAPABILITIES, 0, &CFirmware::HandleGetCapabilities}
+   };
+};
+
+constexpr SCommand<CFirmware> CFirmware::SCommandTable::Commands[] PROGMEM;
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::ExecutePacket(const CPacketControlInterface::CPacket& c_packet) {
+   /* packets with an unknown type or an invalid data length are ignored */
+   CCommandRegistry<CFirmware, SCommandTable>::Dispatch(*this, c_packet);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+/* Reminder: this method is called from the USART receive interrupt */
+bool CFirmware::CEmergencyStopHandler::HandleUrgentPacket(const CPacketControlInterface::CPacket& c_packet) {
+   /* Execute the emergency stop at once, in place of HandleEmerStopLiftActuator */
+   if(c_packet.GetType() == CPacketControlInterface::CPacket::EType::EMER_STOP_LIFT_ACTUATOR &&
+      !c_packet.HasData()) {
+      m_cLiftActuatorSystem.ProcessEvent(CLiftActuatorSystem::ESystemEvent::STOP);
+      return true;
+   }
+   return false;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetUptime(const CPacketControlInterface::CPacket& c_packet) {
+   uint32_t unUptime = m_cTimer.GetMilliseconds();
+   uint8_t punTxData[] = {
+      uint8_t((unUptime >> 24) & 0xFF),
+      uint8_t((unUptime >> 16) & 0xFF),
+      uint8_t((unUptime >> 8 ) & 0xFF),
+      uint8_t((unUptime >> 0 ) & 0xFF)
+   };
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_UPTIME,
+                                        punTxData,
+                                        4);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetBattLvl(const CPacketControlInterface::CPacket& c_packet) {
+   uint8_t unBattLevel = CADCController::GetInstance().GetValue(CADCController::EChannel::ADC6);
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_BATT_LVL,
+                                        &unBattLevel,
+                                        1);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::GetChargerStatus(uint8_t (&pun_data)[2]) {
+   pun_data[0] = (PINC & PWR_MON_PGOOD) ? 0x00 : 0x01;
+   pun_data[1] = (PINC & PWR_MON_CHG) ? 0x00 : 0x01;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::GetLimitSwitchState(uint8_t (&pun_data)[2]) {
+   pun_data[0] = m_cLiftActuatorSystem.GetUpperLimitSwitchState() ? 0x01 : 0x00;
+   pun_data[1] = m_cLiftActuatorSystem.GetLowerLimitSwitchState() ? 0x01 : 0x00;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::PostStateChanges() {
+   uint8_t punChargerStatus[2];
+   GetChargerStatus(punChargerStatus);
+   if(memcmp(punChargerStatus, m_punChargerStatus, sizeof(punChargerStatus)) != 0 &&
+      m_cPacketControlInterface.PostEvent(static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::GET_CHARGER_STATUS),
+                                          punChargerStatus, sizeof(punChargerStatus))) {
+      memcpy(m_punChargerStatus, punChargerStatus, sizeof(punChargerStatus));
+   }
+   uint8_t punLimitSwitchState[2];
+   GetLimitSwitchState(punLimitSwitchState);
+   if(memcmp(punLimitSwitchState, m_punLimitSwitchState, sizeof(punLimitSwitchState)) != 0 &&
+      m_cPacketControlInterface.PostEvent(static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::GET_LIMIT_SWITCH_STATE),
+                                          punLimitSwitchState, sizeof(punLimitSwitchState))) {
+      memcpy(m_punLimitSwitchState, punLimitSwitchState, sizeof(punLimitSwitchState));
+   }
+   /* e.g. the end of a calibration, a position being reached or an emergency stop */
+   CLiftActuatorSystem::ESystemState eLiftActuatorState = m_cLiftActuatorSystem.GetSystemState();
+   uint8_t unLiftActuatorState = static_cast<uint8_t>(eLiftActuatorState);
+   if(eLiftActuatorState != m_eLiftActuatorState &&
+      m_cPacketControlInterface.PostEvent(static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::GET_LIFT_ACTUATOR_STATE),
+                                          &unLiftActuatorState, 1)) {
+      m_eLiftActuatorState = eLiftActuatorState;
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetChargerStatus(const CPacketControlInterface::CPacket& c_packet) {
+   uint8_t punTxData[2];
+   GetChargerStatus(punTxData);
+   m_cPacketControlInterface.SendPacket(
+      CPacketControlInterface::CPacket::EType::GET_CHARGER_STATUS,
+      punTxData,
+      sizeof(punTxData));
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleSetLiftActuatorPosition(const CPacketControlInterface::CPacket& c_packet) {
+   /* Set the position of the lift actuator */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   m_cLiftActuatorSystem.SetPosition(punRxData[0]);
+   m_cLiftActuatorSystem.ProcessEvent(CLiftActuatorSystem::ESystemEvent::START_POSITION_CTRL);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleSetLiftActuatorSpeed(const CPacketControlInterface::CPacket& c_packet) {
+   /* Set the speed of the stepper motor */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   int8_t nSpeed = reinterpret_cast<const int8_t&>(punRxData[0]);
+   m_cLiftActuatorSystem.SetSpeed(nSpeed);
+   m_cLiftActuatorSystem.ProcessEvent(CLiftActuatorSystem::ESystemEvent::START_SPEED_CTRL);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleCalibrateLiftActuator(const CPacketControlInterface::CPacket& c_packet) {
+   m_cLiftActuatorSystem.ProcessEvent(CLiftActuatorSystem::ESystemEvent::START_CALIBRATION);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleEmerStopLiftActuator(const CPacketControlInterface::CPacket& c_packet) {
+   m_cLiftActuatorSystem.ProcessEvent(CLiftActuatorSystem::ESystemEvent::STOP);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetLiftActuatorPosition(const CPacketControlInterface::CPacket& c_packet) {
+   /* Get the position of the lift actuator */
+   m_cPacketControlInterface.SendPacket(
+      CPacketControlInterface::CPacket::EType::GET_LIFT_ACTUATOR_POSITION,
+      m_cLiftActuatorSystem.GetPosition());
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetLiftActuatorState(const CPacketControlInterface::CPacket& c_packet) {
+   /* Get the state of the lift actuator system */
+   m_cPacketControlInterface.SendPacket(
+      CPacketControlInterface::CPacket::EType::GET_LIFT_ACTUATOR_STATE,
+      static_cast<uint8_t>(m_cLiftActuatorSystem.GetSystemState()));
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetLimitSwitchState(const CPacketControlInterface::CPacket& c_packet) {
+   uint8_t punTxData[2];
+   GetLimitSwitchState(punTxData);
+   m_cPacketControlInterface.SendPacket(
+      CPacketControlInterface::CPacket::EType::GET_LIMIT_SWITCH_STATE,
+      punTxData,
+      sizeof(punTxData));
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleSetEMChargeEnable(const CPacketControlInterface::CPacket& c_packet) {
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   if(punRxData[0] != 0) {
+      m_cLiftActuatorSystem.GetElectromagnetController().SetChargeEnable(true);
+   } 
+   else {
+      m_cLiftActuatorSystem.GetElectromagnetController().SetChargeEnable(false);
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleSetEMDischargeMode(const CPacketControlInterface::CPacket& c_packet) {
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   switch(punRxData[0]) {
+   case 0: 
+      m_cLiftActuatorSystem.GetElectromagnetController().SetDischargeMode(
+         CElectromagnetController::EDischargeMode::CONSTRUCTIVE);
+      break;
+   case 1: 
+      m_cLiftActuatorSystem.GetElectromagnetController().SetDischargeMode(
+         CElectromagnetController::EDischargeMode::DESTRUCTIVE);
+      break;
+   default:
+      m_cLiftActuatorSystem.GetElectromagnetController().SetDischargeMode(
+         CElectromagnetController::EDischargeMode::DISABLE);
+      break;
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetEMAccumVoltage(const CPacketControlInterface::CPacket& c_packet) {
+   uint8_t unAccumulatedVoltage = 
+      m_cLiftActuatorSystem.GetElectromagnetController().GetAccumulatedVoltage();
+   m_cPacketControlInterface.SendPacket(
+      CPacketControlInterface::CPacket::EType::GET_EM_ACCUM_VOLTAGE,
+      &unAccumulatedVoltage,
+      1);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleReadSMBusByte(const CPacketControlInterface::CPacket& c_packet) {
+   uint8_t punReplyBuffer[REPLY_BUFFER_LENGTH];
+   uint8_t unAddress = c_packet.GetDataPointer()[0];
+   m_cTWController.Read(unAddress, 1, true);
+   punReplyBuffer[0] = m_cTWController.Read();
+   m_cPacketControlInterface.SendPacket(
+      CPacketControlInterface::CPacket::EType::READ_SMBUS_BYTE,
+      punReplyBuffer,
+      1);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleWriteSMBusByte(const CPacketControlInterface::CPacket& c_packet) {
+   uint8_t unAddress = c_packet.GetDataPointer()[0];
+   uint8_t unData = c_packet.GetDataPointer()[1];
+   m_cTWController.BeginTransmission(unAddress);    
+   m_cTWController.Write(unData);
+   m_cTWController.EndTransmission(true);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleReadSMBusByteData(const CPacketControlInterface::CPacket& c_packet) {
+   uint8_t punReplyBuffer[REPLY_BUFFER_LENGTH];
+   uint8_t unAddress = c_packet.GetDataPointer()[0];
+   uint8_t unRegister = c_packet.GetDataPointer()[1];
+   m_cTWController.BeginTransmission(unAddress);    
+   m_cTWController.Write(unRegister);
+   m_cTWController.EndTransmission(false);
+   m_cTWController.Read(unAddress, 1, true);
+   punReplyBuffer[0] = m_cTWController.Read();
+   m_cPacketControlInterface.SendPacket(
+      CPacketControlInterface::CPacket::EType::READ_SMBUS_BYTE_DATA,
+      punReplyBuffer,
+      1);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleWriteSMBusByteData(const CPacketControlInterface::CPacket& c_packet) {
+   uint8_t unAddress = c_packet.GetDataPointer()[0];
+   uint8_t unRegister = c_packet.GetDataPointer()[1];
+   uint8_t unData = c_packet.GetDataPointer()[2];
+   m_cTWController.BeginTransmission(unAddress);
+   m_cTWController.Write(unRegister);
+   m_cTWController.Write(unData);
+   m_cTWController.EndTransmission(true);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleReadSMBusWordData(const CPacketControlInterface::CPacket& c_packet) {
+   uint8_t punReplyBuffer[REPLY_BUFFER_LENGTH];
+   uint8_t unAddress = c_packet.GetDataPointer()[0];
+   uint8_t unRegister = c_packet.GetDataPointer()[1];
+   m_cTWController.BeginTransmission(unAddress);  
+   m_cTWController.Write(unRegister);
+   m_cTWController.EndTransmission(false);
+   m_cTWController.Read(unAddress, 2, true);
+   punReplyBuffer[0] = m_cTWController.Read();
+   punReplyBuffer[1] = m_cTWController.Read();
+   m_cPacketControlInterface.SendPacket(
+      CPacketControlInterface::CPacket::EType::READ_SMBUS_WORD_DATA,
+      punReplyBuffer,
+      2);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleReadSMBusI2CBlockData(const CPacketControlInterface::CPacket& c_packet) {
+   uint8_t punReplyBuffer[REPLY_BUFFER_LENGTH];
+   uint8_t unAddress = c_packet.GetDataPointer()[0];
+   uint8_t unRegister = c_packet.GetDataPointer()[1];
+   uint8_t unCount = c_packet.GetDataPointer()[2];
+   if(unCount > REPLY_BUFFER_LENGTH) {
+      unCount = REPLY_BUFFER_LENGTH;
+   }
+   m_cTWController.BeginTransmission(unAddress);
+   m_cTWController.Write(unRegister);
+   m_cTWController.EndTransmission(false);
+   m_cTWController.Read(unAddress, unCount, true);
+   for(uint8_t unIndex = 0; unIndex < unCount; unIndex++) {
+      punReplyBuffer[unIndex] = m_cTWController.Read();
+   }
+   m_cPacketControlInterface.SendPacket(
+      CPacketControlInterface::CPacket::EType::READ_SMBUS_I2C_BLOCK_DATA,
+      punReplyBuffer,
+      unCount);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleWriteNFC(const CPacketControlInterface::CPacket& c_packet) {
+   uint8_t punReplyBuffer[REPLY_BUFFER_LENGTH];
+   uint8_t unRxBufferCount = 0;
+   /* the command and the data must fit into the IO buffer of the NFC controller */
+   if(c_packet.HasData() && c_packet.GetDataLength() <= NFC_CMD_BUF_LEN - 2) {
+      if(m_cNFCController.P2PInitiatorInit()) {
+         unRxBufferCount = 
+            m_cNFCController.P2PInitiatorTxRx(c_packet.GetDataPointer(),
+                                              c_packet.GetDataLength(),
+                                              punReplyBuffer,
+                                              REPLY_BUFFER_LENGTH);
       }
+      m_cNFCController.PowerDown();
+      /* reply with the data received from the target, replies longer than a frame
+         are fragmented */
+      m_cPacketControlInterface.SendPacket(
+         CPacketControlInterface::CPacket::EType::WRITE_NFC,
+         punReplyBuffer,
+         unRxBufferCount);
    }
 }
 
 /***********************************************************/
 /***********************************************************/
+
+void CFirmware::HandleSetSubscription(const CPacketControlInterface::CPacket& c_packet) {
+   /* Subscribe to the periodic reply of a request without data */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   uint16_t unPeriod = (punRxData[1] << 8) | punRxData[2];
+   bool bAccepted = false;
+   switch(static_cast<CPacketControlInterface::CPacket::EType>(punRxData[0])) {
+   case CPacketControlInterface::CPacket::EType::GET_UPTIME:
+   case CPacketControlInterface::CPacket::EType::GET_BATT_LVL:
+   case CPacketControlInterface::CPacket::EType::GET_CHARGER_STATUS:
+   case CPacketControlInterface::CPacket::EType::GET_LIFT_ACTUATOR_POSITION:
+   case CPacketControlInterface::CPacket::EType::GET_LIFT_ACTUATOR_STATE:
+   case CPacketControlInterface::CPacket::EType::GET_LIMIT_SWITCH_STATE:
+   case CPacketControlInterface::CPacket::EType::GET_EM_ACCUM_VOLTAGE:
+   case CPacketControlInterface::CPacket::EType::GET_LINK_STATS:
+      bAccepted = m_cPacketControlInterface.SetSubscription(punRxData[0],
+                                                            unPeriod,
+                                                            m_cTimer.GetMilliseconds());
+      break;
+   default:
+      /* not a subscribable packet type */
+      break;
+   }
+   uint8_t punTxData[] = {
+      punRxData[0],
+      uint8_t(bAccepted ? 0x01 : 0x00)
+   };
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::SET_SUBSCRIPTION,
+                                        punTxData,
+                                        sizeof(punTxData));
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleBatch(const CPacketControlInterface::CPacket& c_packet) {
+   /* Execute each sub-packet in order and reply with a single BATCH packet */
+   CPacketControlInterface::CPacket cEntry(0xFF, 0, nullptr);
+   uint8_t unOffset = 0;
+   m_cPacketControlInterface.BeginBatch();
+   while(c_packet.GetBatchEntry(unOffset, cEntry)) {
+      /* nested batches are ignored */
+      if(cEntry.GetType() != CPacketControlInterface::CPacket::EType::BATCH) {
+         ExecutePacket(cEntry);
+      }
+   }
+   m_cPacketControlInterface.EndBatch();
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleSetLinkOptions(const CPacketControlInterface::CPacket& c_packet) {
+   /* Reply with the supported options, then switch to them */
+   uint8_t unLinkOptions = c_packet.GetDataPointer()[0] & SUPPORTED_LINK_OPTIONS;
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::SET_LINK_OPTIONS,
+                                        unLinkOptions);
+   m_cPacketControlInterface.SetLinkOptions(unLinkOptions);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleSetBaudRate(const CPacketControlInterface::CPacket& c_packet) {
+   /* Reply at the current baud rate, then switch to the requested one */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   uint32_t unBaudRate = (static_cast<uint32_t>(punRxData[0]) << 24) |
+                         (static_cast<uint32_t>(punRxData[1]) << 16) |
+                         (static_cast<uint32_t>(punRxData[2]) << 8) |
+                         (static_cast<uint32_t>(punRxData[3]) << 0);
+   bool bSupported = CHUARTController::IsBaudRateSupported(unBaudRate);
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::SET_BAUD_RATE,
+                                        bSupported ? 1 : 0);
+   if(bSupported) {
+      m_cPacketControlInterface.SetBaudRate(unBaudRate, m_cTimer.GetMilliseconds());
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetLinkStats(const CPacketControlInterface::CPacket& c_packet) {
+   /* Requests without data, e.g. from a subscription, do not reset the counters */
+   if(c_packet.GetDataLength() <= 1) {
+      m_cPacketControlInterface.SendLinkStatistics(c_packet.HasData() &&
+                                                   c_packet.GetDataPointer()[0] != 0);
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandlePing(const CPacketControlInterface::CPacket& c_packet) {
+   /* Echo the data, with the receive and transmit times after the flags if requested.
+      The receive time is taken when the frame arrived, not when it was dispatched */
+   uint32_t unRxTime = c_packet.GetArrivalTime();
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   if(!c_packet.HasData() || !(punRxData[0] & PING_FLAG_TIMESTAMPS)) {
+      m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::PING,
+                                           punRxData,
+                                           c_packet.GetDataLength());
+      return;
+   }
+   uint8_t punTxData[MAXIMUM_DATA_LENGTH + PING_TIMESTAMPS_SIZE];
+   uint8_t unTxDataLength = 0;
+   punTxData[unTxDataLength++] = punRxData[0];
+   unTxDataLength += PING_TIMESTAMPS_SIZE;
+   for(uint8_t unIdx = 1; unIdx < c_packet.GetDataLength(); unIdx++) {
+      punTxData[unTxDataLength++] = punRxData[unIdx];
+   }
+   uint32_t punTimes[] = {unRxTime, m_cTimer.GetMicroseconds()};
+   for(uint8_t unIdx = 0; unIdx < PING_TIMESTAMPS_SIZE; unIdx++) {
+      punTxData[1 + unIdx] = (punTimes[unIdx / 4] >> (24 - 8 * (unIdx % 4))) & 0xFF;
+   }
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::PING,
+                                        punTxData,
+                                        unTxDataLength);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleScheduleCommand(const CPacketControlInterface::CPacket& c_packet) {
+   /* Queue the packet that follows the time, Exec executes it once the time is reached */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   bool bAccepted = false;
+   if(c_packet.GetDataLength() >= SCHEDULE_TIME_FIELD_SIZE + TYPE_FIELD_SIZE) {
+      uint32_t unTime = (static_cast<uint32_t>(punRxData[0]) << 24) |
+                        (static_cast<uint32_t>(punRxData[1]) << 16) |
+                        (static_cast<uint32_t>(punRxData[2]) << 8) |
+                        (static_cast<uint32_t>(punRxData[3]) << 0);
+      bAccepted = m_cPacketControlInterface.ScheduleCommand(
+         unTime,
+         punRxData[SCHEDULE_TIME_FIELD_SIZE],
+         &punRxData[SCHEDULE_TIME_FIELD_SIZE + TYPE_FIELD_SIZE],
+         c_packet.GetDataLength() - SCHEDULE_TIME_FIELD_SIZE - TYPE_FIELD_SIZE);
+   }
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::SCHEDULE_COMMAND,
+                                        bAccepted ? 1 : 0);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleAckEvent(const CPacketControlInterface::CPacket& c_packet) {
+   /* Stop repeating the acknowledged event */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   m_cPacketControlInterface.AcknowledgeEvent(punRxData[0], punRxData[1]);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetCapabilities(const CPacketControlInterface::CPacket& c_packet) {
+   uint8_t punTxData[CAPABILITIES_HEADER_SIZE + TYPE_BITMAP_SIZE] = {
+      PROTOCOL_VERSION,
+      BOARD_ID_MANIP,
+      uint8_t((FIRMWARE_BUILD_HASH >> 24) & 0xFF),
+      uint8_t((FIRMWARE_BUILD_HASH >> 16) & 0xFF),
+      uint8_t((FIRMWARE_BUILD_HASH >> 8 ) & 0xFF),
+      uint8_t((FIRMWARE_BUILD_HASH >> 0 ) & 0xFF)
+   };
+   CCommandRegistry<CFirmware, SCommandTable>::GetTypeBitmap(punTxData + CAPABILITIES_HEADER_SIZE);
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_CAPABILITIES,
+                                        punTxData,
+                                        sizeof(punTxData));
+}
+
+/***********************************************************/
+/***********************************************************/
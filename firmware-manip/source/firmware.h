@@ -20,6 +20,7 @@
 #include <tw_channel_selector.h>
 #include <lift_actuator_system.h>
 #include <packet_control_interface.h>
+#include <command_registry.h>
 #include <rf_controller.h>
 
 #define PWR_MON_MASK   0x03
@@ -37,10 +38,6 @@ public:
       return _firmware;
    }
 
-   void SetFilePointer(FILE* ps_huart) {
-      m_psHUART = ps_huart;
-   }
-
    CHUARTController& GetHUARTController() {
       return m_cHUARTController;
    }
@@ -61,6 +58,61 @@ public:
       
 private:
 
+   void ExecutePacket(const CPacketControlInterface::CPacket& c_packet);
+
+   /* Data of the GET_CHARGER_STATUS and GET_LIMIT_SWITCH_STATE replies, which are also
+      sent as events */
+   void GetChargerStatus(uint8_t (&pun_data)[2]);
+   void GetLimitSwitchState(uint8_t (&pun_data)[2]);
+
+   /* Posts the changes of the charger, limit switch and lift actuator states as events */
+   void PostStateChanges();
+
+   /* Packet handlers, dispatched through SCommandTable */
+   void HandleGetUptime(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetBattLvl(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetChargerStatus(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetLiftActuatorPosition(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetLiftActuatorPosition(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetLiftActuatorSpeed(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetLimitSwitchState(const CPacketControlInterface::CPacket& c_packet);
+   void HandleCalibrateLiftActuator(const CPacketControlInterface::CPacket& c_packet);
+   void HandleEmerStopLiftActuator(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetLiftActuatorState(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetEMChargeEnable(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetEMDischargeMode(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetEMAccumVoltage(const CPacketControlInterface::CPacket& c_packet);
+   void HandleWriteNFC(const CPacketControlInterface::CPacket& c_packet);
+   void HandleReadSMBusByte(const CPacketControlInterface::CPacket& c_packet);
+   void HandleReadSMBusByteData(const CPacketControlInterface::CPacket& c_packet);
+   void HandleReadSMBusWordData(const CPacketControlInterface::CPacket& c_packet);
+   void HandleReadSMBusI2CBlockData(const CPacketControlInterface::CPacket& c_packet);
+   void HandleWriteSMBusByte(const CPacketControlInterface::CPacket& c_packet);
+   void HandleWriteSMBusByteData(const CPacketControlInterface::CPacket& c_packet);
+   void HandleBatch(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetSubscription(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetLinkOptions(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetBaudRate(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetLinkStats(const CPacketControlInterface::CPacket& c_packet);
+   void HandlePing(const CPacketControlInterface::CPacket& c_packet);
+   void HandleScheduleCommand(const CPacketControlInterface::CPacket& c_packet);
+   void HandleAckEvent(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetCapabilities(const CPacketControlInterface::CPacket& c_packet);
+
+   struct SCommandTable;
+
+   /* Stops the lift actuator from the receive interrupt */
+   class CEmergencyStopHandler : public CPacketControlInterface::CUrgentPacketHandler {
+   public:
+      CEmergencyStopHandler(CLiftActuatorSystem& c_lift_actuator_system) :
+         m_cLiftActuatorSystem(c_lift_actuator_system) {}
+
+      bool HandleUrgentPacket(const CPacketControlInterface::CPacket& c_packet);
+
+   private:
+      CLiftActuatorSystem& m_cLiftActuatorSystem;
+   };
+
    /* Test Routines */
    void TestPMIC();
    void TestDestructiveField();
@@ -79,7 +131,18 @@ private:
                TIMER2_OVF_vect_num),
       m_cHUARTController(CHUARTController::instance()),
       m_cTWController(CTWController::GetInstance()),
-      m_cPacketControlInterface(m_cHUARTController) {     
+      m_cPacketControlInterface(m_cHUARTController),
+      m_cEmergencyStopHandler(m_cLiftActuatorSystem),
+      m_punChargerStatus(),
+      m_punLimitSwitchState(),
+      m_eLiftActuatorState(CLiftActuatorSystem::ESystemState::INACTIVE) {
+
+      m_cPacketControlInterface.SetUrgentPacketHandler(&m_cEmergencyStopHandler);
+
+      /* Clock of the timestamps sent with LINK_OPTION_TIMESTAMP */
+      m_cPacketControlInterface.SetClock([] {
+         return CFirmware::GetInstance().GetTimer().GetMicroseconds();
+      });
 
       /* Enable interrupts */
       sei();
@@ -107,13 +170,14 @@ private:
 
    CPacketControlInterface m_cPacketControlInterface;
 
-   static CFirmware _firmware;
-
-public: // TODO, don't make these public
-    /* File structs for fprintf */
-   FILE* m_psHUART;
+   CEmergencyStopHandler m_cEmergencyStopHandler;
 
+   /* States reported by the last events */
+   uint8_t m_punChargerStatus[2];
+   uint8_t m_punLimitSwitchState[2];
+   CLiftActuatorSystem::ESystemState m_eLiftActuatorState;
 
+   static CFirmware _firmware;
 
 };
 
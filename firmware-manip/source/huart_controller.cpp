@@ -8,6 +8,8 @@
 
 #include "huart_controller.h"
 
+#include <pending_work.h>
+
 // Singleton Instance /////////////////////////////////////////////////////////////////////////
 CHUARTController CHUARTController::_hardware_serial;
 
@@ -18,8 +20,12 @@ CHUARTController CHUARTController::_hardware_serial;
 // to which to write the next incoming character and tail is the index of the
 // location from which to read.
 
-CHUARTController::SRingBuffer rx_buffer  =  { { 0 }, 0, 0 };
-CHUARTController::SRingBuffer tx_buffer  =  { { 0 }, 0, 0 };
+CHUARTController::CRxBuffer rx_buffer;
+CHUARTController::CTxBuffer tx_buffer;
+
+CHUARTController::CReceiver* rx_receiver = 0;
+
+volatile CHUARTController::SRxStatistics rx_statistics = { 0, 0, 0, 0, 0 };
 
 /****************************************/
 /****************************************/
@@ -27,15 +33,30 @@ CHUARTController::SRingBuffer tx_buffer  =  { { 0 }, 0, 0 };
 /* receive interrupt */
 ISR(USART_RX_vect)
 {
-   if (bit_is_clear(UCSR0A, UPE0)) {
-      unsigned int i = (rx_buffer.head + 1) % SERIAL_BUFFER_SIZE;
-      if (i != rx_buffer.tail) {
-         rx_buffer.buffer[rx_buffer.head] = UDR0;
-         rx_buffer.head = i;
+   // the error flags belong to the byte in UDR0 and must be read first
+   uint8_t status = UCSR0A;
+   unsigned char c = UDR0;
+   rx_statistics.Bytes++;
+   if (status & _BV(DOR0)) {
+      // one or more bytes were lost before this one
+      rx_statistics.DataOverruns++;
+   }
+   if (status & _BV(FE0)) {
+      rx_statistics.FrameErrors++;
+   }
+   if (!(status & _BV(UPE0))) {
+      if (rx_receiver) {
+         rx_receiver->Receive(c);
+      }
+      else if (rx_buffer.Write(c)) {
+         CPendingWork::GetInstance().Set(PENDING_WORK_RX);
+      }
+      else {
+         rx_statistics.BufferOverruns++;
       }
    } 
    else {
-      unsigned char c = UDR0;
+      rx_statistics.ParityErrors++;
    };
 }
 
@@ -45,17 +66,17 @@ ISR(USART_RX_vect)
 /* transmit interrupt */
 ISR(USART_UDRE_vect)
 {
-   if (tx_buffer.head == tx_buffer.tail) {
+   if (tx_buffer.IsEmpty()) {
       // Buffer empty, so disable interrupts
 
       //cbi(UCSR0B, UDRIE0);
       UCSR0B &= ~(_BV(UDRIE0));
+      // the main loop may be waiting to send
+      CPendingWork::GetInstance().Set(PENDING_WORK_TX);
    }
    else {
       // There is more data in the output buffer. Send the next byte
-      unsigned char c = tx_buffer.buffer[tx_buffer.tail];
-      tx_buffer.tail = (tx_buffer.tail + 1) % SERIAL_BUFFER_SIZE;
-      UDR0 = c;
+      UDR0 = tx_buffer.Read();
    }
 }
 
@@ -81,7 +102,7 @@ CHUARTController::CHUARTController() {
    *_ucsrb = 0;
 
    /* start up serial */
-   Begin(57600);
+   Begin(DEFAULT_BAUD_RATE);
 }
 
 // Public Methods //////////////////////////////////////////////////////////////
@@ -110,6 +131,7 @@ try_again:
   // assign the baud_setting, a.k.a. ubbr (USART Baud Rate Register)
   *_ubrrh = baud_setting >> 8;
   *_ubrrl = baud_setting;
+  _baud = baud;
 
   transmitting = false;
 
@@ -120,6 +142,30 @@ try_again:
 
   //cbi(*_ucsrb, _udrie);
   *_ucsrb &= ~(_BV(_udrie));
+
+#ifdef HUART_RTS_PORT
+  // the host may send until the receiver asks it to stop
+  HUART_RTS_PORT &= ~HUART_RTS_MASK;
+  HUART_RTS_DDR |= HUART_RTS_MASK;
+#endif
+}
+
+/****************************************/
+/****************************************/
+
+bool CHUARTController::IsBaudRateSupported(unsigned long baud)
+{
+  if (baud == 0 || baud > F_CPU / 8) {
+    return false;
+  }
+  // same baud_setting as in Begin, the actual baud rate is F_CPU / 8 / (baud_setting + 1)
+  unsigned long baud_setting = (F_CPU / 4 / baud - 1) / 2;
+  if (baud_setting > 4095) {
+    return false;
+  }
+  unsigned long actual = F_CPU / 8 / (baud_setting + 1);
+  unsigned long error = (actual > baud) ? (actual - baud) : (baud - actual);
+  return (error * 40 <= baud);
 }
 
 /****************************************/
@@ -128,7 +174,7 @@ try_again:
 void CHUARTController::End()
 {
   // wait for transmission of outgoing data
-  while (_tx_buffer->head != _tx_buffer->tail);
+  while (!_tx_buffer->IsEmpty());
 
   //cbi(*_ucsrb, _rxen);
   //cbi(*_ucsrb, _txen);
@@ -138,7 +184,7 @@ void CHUARTController::End()
   *_ucsrb &= ~(_BV(_rxen) | _BV(_txen) | _BV(_rxcie) | _BV(_udrie));
   
   // clear any received data
-  _rx_buffer->head = _rx_buffer->tail;
+  _rx_buffer->Clear();
 }
 
 /****************************************/
@@ -146,7 +192,7 @@ void CHUARTController::End()
 
 int CHUARTController::Available(void)
 {
-  return (int)(SERIAL_BUFFER_SIZE + _rx_buffer->head - _rx_buffer->tail) % SERIAL_BUFFER_SIZE;
+  return _rx_buffer->GetLength();
 }
 
 /****************************************/
@@ -154,25 +200,57 @@ int CHUARTController::Available(void)
 
 int CHUARTController::Peek(void)
 {
-  if (_rx_buffer->head == _rx_buffer->tail) {
+  uint8_t c;
+  if (_rx_buffer->Peek(&c, 1) == 0) {
     return -1;
   } else {
-    return _rx_buffer->buffer[_rx_buffer->tail];
+    return c;
   }
 }
 
 /****************************************/
 /****************************************/
 
+void CHUARTController::SetReceiver(CReceiver* pc_receiver)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  rx_receiver = pc_receiver;
+  SREG = oldSREG;
+}
+
+/****************************************/
+/****************************************/
+
+void CHUARTController::GetRxStatistics(SRxStatistics& s_statistics, bool b_reset)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  s_statistics.Bytes = rx_statistics.Bytes;
+  s_statistics.BufferOverruns = rx_statistics.BufferOverruns;
+  s_statistics.DataOverruns = rx_statistics.DataOverruns;
+  s_statistics.FrameErrors = rx_statistics.FrameErrors;
+  s_statistics.ParityErrors = rx_statistics.ParityErrors;
+  if (b_reset) {
+    rx_statistics.Bytes = 0;
+    rx_statistics.BufferOverruns = 0;
+    rx_statistics.DataOverruns = 0;
+    rx_statistics.FrameErrors = 0;
+    rx_statistics.ParityErrors = 0;
+  }
+  SREG = oldSREG;
+}
+
+/****************************************/
+/****************************************/
+
 uint8_t CHUARTController::Read(void)
 {
   // if the head isn't ahead of the tail, we don't have any characters
-  if (_rx_buffer->head == _rx_buffer->tail) {
+  if (_rx_buffer->IsEmpty()) {
     return -1;
   } else {
-    uint8_t c = _rx_buffer->buffer[_rx_buffer->tail];
-    _rx_buffer->tail = (unsigned int)(_rx_buffer->tail + 1) % SERIAL_BUFFER_SIZE;
-    return c;
+    return _rx_buffer->Read();
   }
 }
 
@@ -189,15 +267,10 @@ void CHUARTController::Flush() {
 /****************************************/
 
 uint8_t CHUARTController::Write(uint8_t c) {
-  unsigned int i = (_tx_buffer->head + 1) % SERIAL_BUFFER_SIZE;
-	
   // If the output buffer is full, there's nothing for it other than to 
   // wait for the interrupt handler to empty it a bit
   // ???: return 0 here instead?
-  while (i == _tx_buffer->tail); // os sleep
-	
-  _tx_buffer->buffer[_tx_buffer->head] = c;
-  _tx_buffer->head = i;
+  while (!_tx_buffer->Write(c)); // os sleep
 
   //sbi(*_ucsrb, _udrie);
   *_ucsrb |= _BV(_udrie);
@@ -214,3 +287,48 @@ uint8_t CHUARTController::Write(uint8_t c) {
 /****************************************/
 /****************************************/
 
+bool CHUARTController::Reserve(uint8_t un_length) {
+  if (GetTxBufferSpace() < un_length) {
+    return false;
+  }
+  _tx_reserved = 0;
+  return true;
+}
+
+/****************************************/
+/****************************************/
+
+uint8_t CHUARTController::ReadBlock(uint8_t* pun_data, uint8_t un_length) {
+  return _rx_buffer->ReadBlock(pun_data, un_length);
+}
+
+/****************************************/
+/****************************************/
+
+bool CHUARTController::WriteBlock(const uint8_t* pun_data, uint8_t un_length) {
+  if (!Reserve(un_length)) {
+    return false;
+  }
+  while (_tx_reserved < un_length) {
+    WriteReserved(pun_data[_tx_reserved]);
+  }
+  Commit();
+  return true;
+}
+
+/****************************************/
+/****************************************/
+
+void CHUARTController::Commit() {
+  uint8_t oldSREG = SREG;
+  cli();
+  _tx_buffer->Commit(_tx_reserved);
+  *_ucsrb |= _BV(_udrie);
+  transmitting = true;
+  *_ucsra |= _BV(TXC0);
+  SREG = oldSREG;
+}
+
+/****************************************/
+/****************************************/
+
@@ -260,6 +260,7 @@ void CLiftActuatorSystem::CLimitSwitchInterrupt::ServiceRoutine() {
       (m_bLowerSwitchState && (m_bLowerSwitchState != bLowerSwitchPrevState))) {
       m_pcLiftActuatorSystem->ProcessEvent(CLiftActuatorSystem::ESystemEvent::LIMIT_SWITCH_PRESSED);
    }
+   CPendingWork::GetInstance().Set(PENDING_WORK_LIFT_ACTUATOR);
 }
 
 /***********************************************************/
@@ -312,6 +313,8 @@ void CLiftActuatorSystem::CStepCounterInterrupt::ServiceRoutine() {
    else {
       m_nPosition--;
    }
+   /* the position controller checks the new position */
+   CPendingWork::GetInstance().Set(PENDING_WORK_LIFT_ACTUATOR);
 }
 
 /***********************************************************/
@@ -98,9 +98,6 @@ private:
    bool read_dt(uint8_t *buf, uint8_t len);
    bool read_ack(void);
 
-   void puthex(uint8_t data);
-   void puthex(uint8_t *buf, uint32_t len);
-
    /* data buffer for reading / writing commands */
    uint8_t m_punIOBuffer[NFC_CMD_BUF_LEN];
 
@@ -0,0 +1,31 @@
+#include "pending_work.h"
+
+#include <avr/sleep.h>
+
+/***********************************************************/
+/***********************************************************/
+
+CPendingWork CPendingWork::m_cPendingWork;
+
+/***********************************************************/
+/***********************************************************/
+
+void CPendingWork::Wait() {
+   uint8_t unSREG = SREG;
+   set_sleep_mode(SLEEP_MODE_IDLE);
+   cli();
+   while(m_unBits == 0) {
+      /* the instruction after sei is executed before any pending interrupt, so an
+         interrupt that signals work after the test wakes the microcontroller up */
+      sleep_enable();
+      sei();
+      sleep_cpu();
+      sleep_disable();
+      cli();
+   }
+   m_unBits = 0;
+   SREG = unSREG;
+}
+
+/***********************************************************/
+/***********************************************************/
@@ -0,0 +1,55 @@
+#ifndef PENDING_WORK_H
+#define PENDING_WORK_H
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/* Work signalled by the shared interrupts: a tick of the system timer, a received
+   frame or byte, an empty transmit buffer and a completed queued I2C transaction */
+#define PENDING_WORK_TIMER 0x01
+#define PENDING_WORK_RX 0x02
+#define PENDING_WORK_TX 0x04
+#define PENDING_WORK_TW 0x08
+
+/* Power Management Microcontroller: a change of the switch or power signals */
+#define PENDING_WORK_POWER_EVENT 0x10
+
+/* Manipulator Microcontroller: a limit switch or a step of the lift actuator */
+#define PENDING_WORK_LIFT_ACTUATOR 0x20
+
+/*
+ * Bits of work that the interrupts signal to the main loop. Between the iterations
+ * of the main loop, the microcontroller sleeps in the idle mode until a bit is set,
+ * so that the interrupts that do not signal work, such as the bytes in the middle
+ * of a frame or the pulses of the shaft encoders, do not run the main loop. Work
+ * that the main loop leaves for itself is picked up on the next timer tick.
+ */
+class CPendingWork {
+
+public:
+   static CPendingWork& GetInstance() {
+      return m_cPendingWork;
+   }
+
+   /* Signals work, also called from the interrupt context */
+   void Set(uint8_t un_bits) {
+      uint8_t unSREG = SREG;
+      cli();
+      m_unBits |= un_bits;
+      SREG = unSREG;
+   }
+
+   /* Sleeps until work is signalled and clears the signalled bits */
+   void Wait();
+
+private:
+   CPendingWork() :
+      m_unBits(0) {}
+
+   static CPendingWork m_cPendingWork;
+
+   volatile uint8_t m_unBits;
+};
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stdint.h>
+
+/*
+ * Ring buffer of bytes for a single producer and a single consumer, e.g. an
+ * interrupt and the main loop, which need no locking. UN_SIZE is a power of
+ * two of at most 128, so the indices are single bytes, which are read and
+ * written atomically, and wrap with a mask. One byte is left free to tell a
+ * full buffer from an empty one. The head is only written by the producer
+ * and the tail only by the consumer.
+ */
+template<uint8_t UN_SIZE>
+class CRingBuffer {
+
+   static_assert(UN_SIZE >= 2 && UN_SIZE <= 128 && (UN_SIZE & (UN_SIZE - 1)) == 0,
+                 "the size of a ring buffer must be a power of two between 2 and 128");
+
+public:
+   CRingBuffer() :
+      m_unHead(0),
+      m_unTail(0) {}
+
+   /* Number of bytes that can be read */
+   uint8_t GetLength() const {
+      return (m_unHead - m_unTail) & MASK;
+   }
+
+   /* Number of bytes that can be written */
+   uint8_t GetSpace() const {
+      return (m_unTail - m_unHead - 1) & MASK;
+   }
+
+   bool IsEmpty() const {
+      return m_unHead == m_unTail;
+   }
+
+   /*************************************/
+   /* Producer                          */
+   /*************************************/
+
+   /* Returns false if the buffer is full */
+   bool Write(uint8_t un_byte) {
+      if(GetSpace() == 0) {
+         return false;
+      }
+      WriteAt(0, un_byte);
+      Commit(1);
+      return true;
+   }
+
+   /* Writes all un_length bytes, or none and returns false if they do not fit */
+   bool WriteBlock(const uint8_t* pun_data, uint8_t un_length) {
+      if(un_length > GetSpace()) {
+         return false;
+      }
+      for(uint8_t unIdx = 0; unIdx < un_length; unIdx++) {
+         WriteAt(unIdx, pun_data[unIdx]);
+      }
+      Commit(un_length);
+      return true;
+   }
+
+   /* Writes a byte un_offset bytes after the head, which the consumer does not see
+      until it is committed. The caller checks the space with GetSpace */
+   void WriteAt(uint8_t un_offset, uint8_t un_byte) {
+      m_punBuffer[(m_unHead + un_offset) & MASK] = un_byte;
+   }
+
+   /* Hands the next un_length bytes written with WriteAt to the consumer at once */
+   void Commit(uint8_t un_length) {
+      /* the bytes must be stored before the consumer sees the new head */
+      asm volatile("" ::: "memory");
+      m_unHead = (m_unHead + un_length) & MASK;
+   }
+
+   /*************************************/
+   /* Consumer                          */
+   /*************************************/
+
+   /* Returns the next byte, the caller checks that the buffer is not empty */
+   uint8_t Read() {
+      uint8_t unByte = m_punBuffer[m_unTail];
+      Discard(1);
+      return unByte;
+   }
+
+   /* Reads up to un_length bytes and returns the number of bytes read */
+   uint8_t ReadBlock(uint8_t* pun_data, uint8_t un_length) {
+      uint8_t unLength = Peek(pun_data, un_length);
+      Discard(unLength);
+      return unLength;
+   }
+
+   /* Copies up to un_length bytes without removing them, returns the number of bytes copied */
+   uint8_t Peek(uint8_t* pun_data, uint8_t un_length) const {
+      uint8_t unLength = GetLength();
+      if(un_length < unLength) {
+         unLength = un_length;
+      }
+      for(uint8_t unIdx = 0; unIdx < unLength; unIdx++) {
+         pun_data[unIdx] = m_punBuffer[(m_unTail + unIdx) & MASK];
+      }
+      return unLength;
+   }
+
+   /* Removes un_length bytes, the caller checks that they were written */
+   void Discard(uint8_t un_length) {
+      /* the bytes must be loaded before the producer sees the new tail */
+      asm volatile("" ::: "memory");
+      m_unTail = (m_unTail + un_length) & MASK;
+   }
+
+   void Clear() {
+      Discard(GetLength());
+   }
+
+private:
+   static const uint8_t MASK = UN_SIZE - 1;
+
+   uint8_t m_punBuffer[UN_SIZE];
+   volatile uint8_t m_unHead;
+   volatile uint8_t m_unTail;
+};
+
+#endif
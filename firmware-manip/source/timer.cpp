@@ -1,5 +1,7 @@
 #include "timer.h"
 
+#include <pending_work.h>
+
 #include <avr/interrupt.h>
 
 #define CLOCK_CYCLES_PER_MICROSECOND() ( F_CPU / 1000000L )
@@ -41,6 +43,7 @@ void CTimer::COverflowInterrupt::ServiceRoutine() {
    m_pcTimer->m_unTimerFraction = unTimerFraction;
    m_pcTimer->m_unTimerMilliseconds = unTimerMilliseconds;
    m_pcTimer->m_unOverflowCount++;
+   CPendingWork::GetInstance().Set(PENDING_WORK_TIMER);
 }
 
 /****************************************/
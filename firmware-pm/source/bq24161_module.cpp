@@ -41,19 +41,33 @@
 /***********************************************************/
 
 void CBQ24161Module::ResetWatchdogTimer() {
-   CFirmware::GetInstance().GetTWController().BeginTransmission(BQ24161_ADDR);
-   CFirmware::GetInstance().GetTWController().Write(R0_ADDR);
-   CFirmware::GetInstance().GetTWController().EndTransmission(false);
-   CFirmware::GetInstance().GetTWController().Read(BQ24161_ADDR, 1, true);
-
-   uint8_t unRegVal = CFirmware::GetInstance().GetTWController().Read();
+   /* the previous reset is still in progress */
+   if(m_sWatchdogTransaction.Result == TW_RESULT_PENDING) {
+      return;
+   }
+   /* read register 0, the handler writes it back with the reset bit set */
+   m_punWatchdogBuffer[0] = R0_ADDR;
+   m_sWatchdogTransaction.Address = BQ24161_ADDR;
+   m_sWatchdogTransaction.Buffer = m_punWatchdogBuffer;
+   m_sWatchdogTransaction.WriteLength = 1;
+   m_sWatchdogTransaction.ReadLength = 1;
+   m_sWatchdogTransaction.RepeatedStart = true;
+   m_sWatchdogTransaction.Handler = &m_cWatchdogHandler;
+   CFirmware::GetInstance().GetTWController().Submit(m_sWatchdogTransaction);
+}
 
-   unRegVal |= R0_WDT_RST_MASK;
+/***********************************************************/
+/***********************************************************/
 
-   CFirmware::GetInstance().GetTWController().BeginTransmission(BQ24161_ADDR);
-   CFirmware::GetInstance().GetTWController().Write(R0_ADDR);
-   CFirmware::GetInstance().GetTWController().Write(unRegVal);
-   CFirmware::GetInstance().GetTWController().EndTransmission(true);
+/* Reminder: this method is called from the TWI interrupt */
+void CBQ24161Module::CWatchdogHandler::HandleTransaction(CTWController::STransaction& s_transaction) {
+   if(s_transaction.Result == TW_RESULT_SUCCESS && s_transaction.ReadLength != 0) {
+      s_transaction.Buffer[1] = s_transaction.Buffer[0] | R0_WDT_RST_MASK;
+      s_transaction.Buffer[0] = R0_ADDR;
+      s_transaction.WriteLength = 2;
+      s_transaction.ReadLength = 0;
+      CFirmware::GetInstance().GetTWController().Submit(s_transaction);
+   }
 }
 
 /***********************************************************/
@@ -64,10 +78,9 @@ void CBQ24161Module::DumpRegister(uint8_t un_addr) {
    CFirmware::GetInstance().GetTWController().Write(un_addr);
    CFirmware::GetInstance().GetTWController().EndTransmission(false);
    CFirmware::GetInstance().GetTWController().Read(BQ24161_ADDR, 1, true);
-   fprintf(CFirmware::GetInstance().m_psHUART,
-           "Register 0x%02x : 0x%02x\r\n",
-           un_addr,
-           CFirmware::GetInstance().GetTWController().Read());
+   CLog::GetInstance().Write<CLog::EMessage::BQ24161_REGISTER>(
+      un_addr,
+      CFirmware::GetInstance().GetTWController().Read());
 }
 
 /***********************************************************/
@@ -3,8 +3,12 @@
 
 #include <stdint.h>
 
+#include <tw_controller.h>
+
 class CBQ24161Module {
 public:
+   CBQ24161Module() :
+      m_sWatchdogTransaction() {}
 
    enum class EFault : uint8_t {
       NONE = 0,
@@ -74,6 +78,7 @@ public:
 
    void SetBatteryTerminationCurrent(uint16_t un_batt_term_current_ma);
 
+   /* Resets the watchdog timer in the background with queued I2C transactions */
    void ResetWatchdogTimer();
 
    EFault GetFault();
@@ -95,6 +100,15 @@ private:
    EDeviceState eDeviceState;
    EInputState eAdapterInputState, eUSBInputState;
    EBatteryState eBatteryState;
+
+   /* writes register 0 back with the watchdog reset bit once it has been read */
+   class CWatchdogHandler : public CTWController::CTransactionHandler {
+   public:
+      void HandleTransaction(CTWController::STransaction& s_transaction);
+   } m_cWatchdogHandler;
+
+   uint8_t m_punWatchdogBuffer[2];
+   CTWController::STransaction m_sWatchdogTransaction;
 };
 
 #endif
@@ -26,10 +26,9 @@ void CBQ24250Module::DumpRegister(uint8_t un_addr) {
    CFirmware::GetInstance().GetTWController().Write(un_addr);
    CFirmware::GetInstance().GetTWController().EndTransmission(false);
    CFirmware::GetInstance().GetTWController().Read(BQ24250_ADDR, 1, true);
-   fprintf(CFirmware::GetInstance().m_psHUART,
-           "Register 0x%02x : 0x%02x\r\n",
-           un_addr,
-           CFirmware::GetInstance().GetTWController().Read());
+   CLog::GetInstance().Write<CLog::EMessage::BQ24250_REGISTER>(
+      un_addr,
+      CFirmware::GetInstance().GetTWController().Read());
 }
 
 /***********************************************************/
@@ -182,17 +181,19 @@ void CBQ24250Module::SetInputLimit(EInputLimit eInputLimit) {
 /***********************************************************/
 
 void CBQ24250Module::ResetWatchdogTimer() {
-   CFirmware::GetInstance().GetTWController().BeginTransmission(BQ24250_ADDR);
-   CFirmware::GetInstance().GetTWController().Write(0x00);
-   CFirmware::GetInstance().GetTWController().Write(0x40);
-   CFirmware::GetInstance().GetTWController().EndTransmission(true);
-
-   // DEBUG
-   CFirmware::GetInstance().GetTWController().BeginTransmission(BQ24250_ADDR);
-   CFirmware::GetInstance().GetTWController().Write(0x00);
-   CFirmware::GetInstance().GetTWController().EndTransmission(false);
-   CFirmware::GetInstance().GetTWController().Read(BQ24250_ADDR, 1, true);
-   CFirmware::GetInstance().GetTWController().Read();
+   /* the previous reset is still in progress */
+   if(m_sWatchdogTransaction.Result == TW_RESULT_PENDING) {
+      return;
+   }
+   m_punWatchdogBuffer[0] = 0x00;
+   m_punWatchdogBuffer[1] = 0x40;
+   m_sWatchdogTransaction.Address = BQ24250_ADDR;
+   m_sWatchdogTransaction.Buffer = m_punWatchdogBuffer;
+   m_sWatchdogTransaction.WriteLength = 2;
+   m_sWatchdogTransaction.ReadLength = 0;
+   m_sWatchdogTransaction.RepeatedStart = false;
+   m_sWatchdogTransaction.Handler = nullptr;
+   CFirmware::GetInstance().GetTWController().Submit(m_sWatchdogTransaction);
 }
 
 /***********************************************************/
@@ -3,8 +3,12 @@
 
 #include <stdint.h>
 
+#include <tw_controller.h>
+
 class CBQ24250Module {
 public:
+   CBQ24250Module() :
+      m_sWatchdogTransaction() {}
 
    enum class EFault : uint8_t {
       NONE = 0,
@@ -51,6 +55,7 @@ public:
    void SetRegisterValue(uint8_t un_addr, uint8_t un_mask, uint8_t un_value);
    uint8_t GetRegisterValue(uint8_t un_addr, uint8_t un_mask);
 
+   /* Resets the watchdog timer in the background with a queued I2C transaction */
    void ResetWatchdogTimer();
 
    bool GetWatchdogEnabled() {
@@ -76,6 +81,9 @@ private:
    EDeviceState eDeviceState;
    bool bWatchdogEnabled;
    bool bWatchdogFault;
+
+   uint8_t m_punWatchdogBuffer[2];
+   CTWController::STransaction m_sWatchdogTransaction;
 };
 
 #endif
@@ -0,0 +1,71 @@
+#ifndef DELTA_ENCODER_H
+#define DELTA_ENCODER_H
+
+#include <stdint.h>
+#include <string.h>
+
+/* Sequence number acknowledged by a host that holds no snapshot */
+#define DELTA_SEQUENCE_NONE 0
+
+/*
+ * Delta encoding of a telemetry reply of UN_FIELD_COUNT one byte fields. A request
+ * with a single data byte acknowledges the sequence number of the last snapshot
+ * the host received, and is answered with [sequence number, bitmap, fields], where
+ * the bitmap (LSB first, one bit per field) marks the fields that changed since the
+ * last acknowledged snapshot and only these fields follow. If a reply is lost, the
+ * host acknowledges its previous snapshot again and the next reply is based on it.
+ * An unknown or zero sequence number is answered with all fields.
+ */
+template<uint8_t UN_FIELD_COUNT>
+class CDeltaEncoder {
+
+public:
+   static const uint8_t BITMAP_SIZE = (UN_FIELD_COUNT + 7) / 8;
+   static const uint8_t MAXIMUM_LENGTH = 1 + BITMAP_SIZE + UN_FIELD_COUNT;
+
+   CDeltaEncoder() :
+      m_unBaseSequence(DELTA_SEQUENCE_NONE),
+      m_unSentSequence(DELTA_SEQUENCE_NONE) {}
+
+   /* Writes the reply for the current fields pun_fields into pun_tx_data, which holds
+      MAXIMUM_LENGTH bytes, and returns its length */
+   uint8_t Encode(uint8_t un_acknowledged_sequence,
+                  const uint8_t* pun_fields,
+                  uint8_t* pun_tx_data) {
+      if(un_acknowledged_sequence != DELTA_SEQUENCE_NONE &&
+         un_acknowledged_sequence == m_unSentSequence) {
+         memcpy(m_punBase, m_punSent, UN_FIELD_COUNT);
+         m_unBaseSequence = m_unSentSequence;
+      }
+      else if(un_acknowledged_sequence != m_unBaseSequence) {
+         /* the host holds no snapshot or one that was not sent since the reset */
+         m_unBaseSequence = DELTA_SEQUENCE_NONE;
+      }
+      if(++m_unSentSequence == DELTA_SEQUENCE_NONE) {
+         m_unSentSequence++;
+      }
+      memcpy(m_punSent, pun_fields, UN_FIELD_COUNT);
+
+      uint8_t unLength = 0;
+      pun_tx_data[unLength++] = m_unSentSequence;
+      uint8_t* punBitmap = &pun_tx_data[unLength];
+      memset(punBitmap, 0, BITMAP_SIZE);
+      unLength += BITMAP_SIZE;
+      for(uint8_t unIdx = 0; unIdx < UN_FIELD_COUNT; unIdx++) {
+         if(m_unBaseSequence == DELTA_SEQUENCE_NONE || pun_fields[unIdx] != m_punBase[unIdx]) {
+            punBitmap[unIdx / 8] |= (1 << (unIdx % 8));
+            pun_tx_data[unLength++] = pun_fields[unIdx];
+         }
+      }
+      return unLength;
+   }
+
+private:
+   /* last snapshot acknowledged by the host and last snapshot sent to it */
+   uint8_t m_unBaseSequence;
+   uint8_t m_unSentSequence;
+   uint8_t m_punBase[UN_FIELD_COUNT];
+   uint8_t m_punSent[UN_FIELD_COUNT];
+};
+
+#endif
@@ -25,22 +25,6 @@ CFirmware CFirmware::_firmware;
 /* main function that runs the firmware */
 int main(void)
 {
-   /* FILE structs for fprintf */
-   FILE huart;
-
-   /* Set up FILE structs for fprintf */                           
-   fdev_setup_stream(&huart, 
-                     [](char c_to_write, FILE* pf_stream) {
-                        CFirmware::GetInstance().GetHUARTController().Write(c_to_write);
-                        return 1;
-                     },
-                     [](FILE* pf_stream) {
-                        return int(CFirmware::GetInstance().GetHUARTController().Read());
-                     },
-                     _FDEV_SETUP_RW);
-
-   CFirmware::GetInstance().SetFilePointer(&huart);
-
    /* Execute the firmware */
    CFirmware::GetInstance().Exec();
    /* Terminate */
@@ -124,6 +108,7 @@ void CFirmware::CPowerEventInterrupt::ServiceRoutine() {
          m_pcFirmware->m_bActuatorPowerSignal ||
          ((unPortSnapshot & PORTC_ACTUATOR_POWER_IRQ) == 0);
    }
+   CPendingWork::GetInstance().Set(PENDING_WORK_POWER_EVENT);
    m_unPortLast = unPortSnapshot;
 }
 
@@ -134,6 +119,7 @@ void CFirmware::Exec()
 {
    uint32_t unLastSyncTime = 0;
    uint32_t unSwitchPressedTime = 0;
+   bool bSoftPowerDownRequested = false;
    bool bSyncRequiredSignal = false;
 
    m_cPowerManagementSystem.Init();
@@ -146,6 +132,7 @@ void CFirmware::Exec()
             m_bSwitchSignal = false;
             if(m_eSwitchState == ESwitchState::PRESSED) {
                unSwitchPressedTime = GetTimer().GetMilliseconds();
+               bSoftPowerDownRequested = false;
             }
          }
          if(m_bUSBSignal) {
@@ -183,9 +170,10 @@ void CFirmware::Exec()
                /* Assert the sync required signal */
                bSyncRequiredSignal = true;
             }
-            /* Soft power down */
-            else {
-               m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::REQ_SOFT_PWDN);
+            /* Soft power down, requested once per press of the switch */
+            else if(!bSoftPowerDownRequested) {
+               bSoftPowerDownRequested =
+                  m_cPacketControlInterface.PostEvent(static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::REQ_SOFT_PWDN));
             }
          }
          else { /* !m_cPowerManagementSystem.IsSystemPowerOn() */
@@ -202,107 +190,28 @@ void CFirmware::Exec()
       m_cPacketControlInterface.ProcessInput();
 
       if(m_cPacketControlInterface.GetState() == CPacketControlInterface::EState::RECV_COMMAND) {
-         CPacketControlInterface::CPacket cPacket = m_cPacketControlInterface.GetPacket();
-         switch(cPacket.GetType()) {
-         case CPacketControlInterface::CPacket::EType::GET_UPTIME:
-            if(cPacket.GetDataLength() == 0) {
-               uint32_t unUptime = m_cTimer.GetMilliseconds();
-               uint8_t punTxData[] = {
-                  uint8_t((unUptime >> 24) & 0xFF),
-                  uint8_t((unUptime >> 16) & 0xFF),
-                  uint8_t((unUptime >> 8 ) & 0xFF),
-                  uint8_t((unUptime >> 0 ) & 0xFF)
-               };
-               m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_UPTIME,
-                                                    punTxData,
-                                                    sizeof(punTxData));
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::GET_BATT_LVL:
-            if(cPacket.GetDataLength() == 0) {
-               uint8_t punTxData[] = {
-                  CADCController::GetInstance().GetValue(CADCController::EChannel::ADC6),
-                  CADCController::GetInstance().GetValue(CADCController::EChannel::ADC7)         
-               };
-               m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_BATT_LVL,
-                                                    punTxData,
-                                                    sizeof(punTxData));
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::GET_PM_STATUS:
-            if(cPacket.GetDataLength() == 0) {
-               uint8_t punTxData[] = {
-                  m_cPowerManagementSystem.IsSystemPowerOn(),
-                  m_cPowerManagementSystem.IsActuatorPowerOn(),
-                  m_cPowerManagementSystem.IsPassthroughPowerOn(),
-                  m_cPowerManagementSystem.IsSystemBatteryCharging(),
-                  m_cPowerManagementSystem.IsActuatorBatteryCharging(),
-                  static_cast<uint8_t>(m_cPowerManagementSystem.GetSystemInputLimit()),
-                  static_cast<uint8_t>(m_cPowerManagementSystem.GetActuatorInputLimit()),
-                  static_cast<uint8_t>(m_cPowerManagementSystem.GetAdapterInputState()),
-                  static_cast<uint8_t>(m_cPowerManagementSystem.GetUSBInputState()),
-               };
-               m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_PM_STATUS,
-                                                    punTxData,
-                                                    sizeof(punTxData));
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::GET_USB_STATUS:
-            if(cPacket.GetDataLength() == 0) {
-               uint8_t punTxData[] = {
-                  CUSBInterfaceSystem::GetInstance().IsEnabled(),
-                  CUSBInterfaceSystem::GetInstance().IsHighSpeedMode(),
-                  CUSBInterfaceSystem::GetInstance().IsSuspended(),
-                  static_cast<uint8_t>(CUSBInterfaceSystem::GetInstance().GetUSBChargerType()),
-               };
-               m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_USB_STATUS,
-                                                    punTxData,
-                                                    sizeof(punTxData));
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::SET_SYSTEM_POWER_ENABLE:
-            /* Set the enable signal for the actuator power supply */
-            if(cPacket.GetDataLength() == 1) {
-               const uint8_t* punRxData = cPacket.GetDataPointer();
-               m_cPowerManagementSystem.SetSystemPowerOn((punRxData[0] != 0) ? true : false);
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::SET_ACTUATOR_POWER_ENABLE:
-            /* Set the enable signal for the actuator power supply */
-            if(cPacket.GetDataLength() == 1) {
-               const uint8_t* punRxData = cPacket.GetDataPointer();
-               m_cPowerManagementSystem.SetActuatorPowerOn((punRxData[0] != 0) ? true : false);
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::SET_ACTUATOR_INPUT_LIMIT_OVERRIDE:
-            /* Set the speed of the differential drive system */
-            if(cPacket.GetDataLength() == 1) {
-               const uint8_t* punRxData = cPacket.GetDataPointer();
-               CBQ24250Module::EInputLimit e_input_limit = CBQ24250Module::EInputLimit::LHIZ;
-               switch (punRxData[0]) {
-               case 1:
-                  e_input_limit = CBQ24250Module::EInputLimit::L100;
-                  break;
-               case 2:
-                  e_input_limit = CBQ24250Module::EInputLimit::L150;
-                  break;
-               case 3:
-                  e_input_limit = CBQ24250Module::EInputLimit::L500;
-                  break;
-               case 4:
-                  e_input_limit = CBQ24250Module::EInputLimit::L900;
-                  break;
-               default:
-                  /* case 0 or invalid is LHIZ (no override / auto mode) */
-                  break;
-               }
-               m_cPowerManagementSystem.SetActuatorInputLimitOverride(e_input_limit);
-            }
-            break;
-         default:
-            /* unknown command */
-            break;
-         }
+         ExecutePacket(m_cPacketControlInterface.GetPacket());
+      }
+      /* Generate the requests of the subscriptions that are due */
+      CPacketControlInterface::CPacket cSubscriptionPacket(0xFF, 0, nullptr);
+      if(m_cPacketControlInterface.GetDueSubscription(m_cTimer.GetMilliseconds(), cSubscriptionPacket)) {
+         ExecutePacket(cSubscriptionPacket);
+      }
+      /* Execute the scheduled command that is due */
+      CPacketControlInterface::CPacket cScheduledPacket(0xFF, 0, nullptr);
+      if(m_cPacketControlInterface.GetDueCommand(m_cTimer.GetMicroseconds(), cScheduledPacket)) {
+         ExecutePacket(cScheduledPacket);
+      }
+      /* Restore the previous baud rate if the host did not follow a change */
+      m_cPacketControlInterface.CheckBaudRate(m_cTimer.GetMilliseconds());
+      /* Send the posted events */
+      m_cPacketControlInterface.SendEvents(m_cTimer.GetMilliseconds());
+      /* Send the log while the link is idle */
+      m_cPacketControlInterface.SendLog(CLog::GetInstance());
+      /* Sleep until an interrupt signals work, scheduled commands are polled so that
+         they are executed at their time and not at the next timer tick */
+      if(!m_cPacketControlInterface.HasScheduledCommands()) {
+         CPendingWork::GetInstance().Wait();
       }
    }
 }
@@ -310,3 +219,325 @@ void CFirmware::Exec()
 /***********************************************************/
 /***********************************************************/
 
+/* Packet handlers and the data length they expect, sorted by type id */
+struct CFirmware::SCommandTable {
+   static constexpr SCommand<CFirmware> Commands[] PROGMEM = {
+      {CPacketControlInterface::CPacket::EType::GET_UPTIME, 0, &CFirmware::HandleGetUptime},
+      {CPacketControlInterface::CPacket::EType::GET_BATT_LVL, 0, &CFirmware::HandleGetBattLvl},
+      {CPacketControlInterface::CPacket::EType::SET_SYSTEM_POWER_ENABLE, 1, &CFirmware::HandleSetSystemPowerEnable},
+      {CPacketControlInterface::CPacket::EType::SET_ACTUATOR_POWER_ENABLE, 1, &CFirmware::HandleSetActuatorPowerEnable},
+      {CPacketControlInterface::CPacket::EType::SET_ACTUATOR_INPUT_LIMIT_OVERRIDE, 1, &CFirmware::HandleSetActuatorInputLimitOverride},
+      {CPacketControlInterface::CPacket::EType::GET_PM_STATUS, VARIABLE_DATA_LENGTH, &CFirmware::HandleGetPMStatus},
+      {CPacketControlInterface::CPacket::EType::GET_USB_STATUS, 0, &CFirmware::HandleGetUSBStatus},
+      {CPacketControlInterface::CPacket::EType::BATCH, VARIABLE_DATA_LENGTH, &CFirmware::HandleBatch},
+      {CPacketControlInterface::CPacket::EType::SET_SUBSCRIPTION, 3, &CFirmware::HandleSetSubscription},
+      {CPacketControlInterface::CPacket::EType::SET_LINK_OPTIONS, 1, &CFirmware::HandleSetLinkOptions},
+      {CPacketControlInterface::CPacket::EType::SET_BAUD_RATE, 4, &CFirmware::HandleSetBaudRate},
+      {CPacketControlInterface::CPacket::EType::GET_LINK_STATS, VARIABLE_DATA_LENGTH, &CFirmware::HandleGetLinkStats},
+      {CPacketControlInterface::CPacket::EType::PING, VARIABLE_DATA_LENGTH, &CFirmware::HandlePing},
+      {CPacketControlInterface::CPacket::EType::SCHEDULE_COMMAND, VARIABLE_DATA_LENGTH, &CFirmware::HandleScheduleCommand},
+      {CPacketControlInterface::CPacket::EType::ACK_EVENT, 2, &CFirmware::HandleAckEvent},
+      {CPacketControlInterface::CPacket::EType::GET_CAPABILITIES, 0, &CFirmware::HandleGetCapabilities}
+   };
+};
+
+constexpr SCommand<CFirmware> CFirmware::SCommandTable::Commands[] PROGMEM;
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::ExecutePacket(const CPacketControlInterface::CPacket& c_packet) {
+   /* packets with an unknown type or an invalid data length are ignored */
+   CCommandRegistry<CFirmware, SCommandTable>::Dispatch(*this, c_packet);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetUptime(const CPacketControlInterface::CPacket& c_packet) {
+   uint32_t unUptime = m_cTimer.GetMilliseconds();
+   uint8_t punTxData[] = {
+      uint8_t((unUptime >> 24) & 0xFF),
+      uint8_t((unUptime >> 16) & 0xFF),
+      uint8_t((unUptime >> 8 ) & 0xFF),
+      uint8_t((unUptime >> 0 ) & 0xFF)
+   };
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_UPTIME,
+                                        punTxData,
+                                        sizeof(punTxData));
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetBattLvl(const CPacketControlInterface::CPacket& c_packet) {
+   uint8_t punTxData[] = {
+      CADCController::GetInstance().GetValue(CADCController::EChannel::ADC6),
+      CADCController::GetInstance().GetValue(CADCController::EChannel::ADC7)         
+   };
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_BATT_LVL,
+                                        punTxData,
+                                        sizeof(punTxData));
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetPMStatus(const CPacketControlInterface::CPacket& c_packet) {
+   uint8_t punFields[PM_STATUS_FIELD_COUNT] = {
+      m_cPowerManagementSystem.IsSystemPowerOn(),
+      m_cPowerManagementSystem.IsActuatorPowerOn(),
+      m_cPowerManagementSystem.IsPassthroughPowerOn(),
+      m_cPowerManagementSystem.IsSystemBatteryCharging(),
+      m_cPowerManagementSystem.IsActuatorBatteryCharging(),
+      static_cast<uint8_t>(m_cPowerManagementSystem.GetSystemInputLimit()),
+      static_cast<uint8_t>(m_cPowerManagementSystem.GetActuatorInputLimit()),
+      static_cast<uint8_t>(m_cPowerManagementSystem.GetAdapterInputState()),
+      static_cast<uint8_t>(m_cPowerManagementSystem.GetUSBInputState()),
+   };
+   if(!c_packet.HasData()) {
+      m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_PM_STATUS,
+                                           punFields,
+                                           sizeof(punFields));
+   }
+   else if(c_packet.GetDataLength() == 1) {
+      /* The data is the last acknowledged snapshot, only send the fields changed since */
+      uint8_t punTxData[CDeltaEncoder<PM_STATUS_FIELD_COUNT>::MAXIMUM_LENGTH];
+      uint8_t unTxDataLength = m_cPMStatusEncoder.Encode(c_packet.GetDataPointer()[0],
+                                                         punFields,
+                                                         punTxData);
+      m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_PM_STATUS,
+                                           punTxData,
+                                           unTxDataLength);
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetUSBStatus(const CPacketControlInterface::CPacket& c_packet) {
+   uint8_t punTxData[] = {
+      CUSBInterfaceSystem::GetInstance().IsEnabled(),
+      CUSBInterfaceSystem::GetInstance().IsHighSpeedMode(),
+      CUSBInterfaceSystem::GetInstance().IsSuspended(),
+      static_cast<uint8_t>(CUSBInterfaceSystem::GetInstance().GetUSBChargerType()),
+   };
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_USB_STATUS,
+                                        punTxData,
+                                        sizeof(punTxData));
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleSetSystemPowerEnable(const CPacketControlInterface::CPacket& c_packet) {
+   /* Set the enable signal for the actuator power supply */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   m_cPowerManagementSystem.SetSystemPowerOn((punRxData[0] != 0) ? true : false);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleSetActuatorPowerEnable(const CPacketControlInterface::CPacket& c_packet) {
+   /* Set the enable signal for the actuator power supply */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   m_cPowerManagementSystem.SetActuatorPowerOn((punRxData[0] != 0) ? true : false);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleSetActuatorInputLimitOverride(const CPacketControlInterface::CPacket& c_packet) {
+   /* Set the speed of the differential drive system */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   CBQ24250Module::EInputLimit e_input_limit = CBQ24250Module::EInputLimit::LHIZ;
+   switch (punRxData[0]) {
+   case 1:
+      e_input_limit = CBQ24250Module::EInputLimit::L100;
+      break;
+   case 2:
+      e_input_limit = CBQ24250Module::EInputLimit::L150;
+      break;
+   case 3:
+      e_input_limit = CBQ24250Module::EInputLimit::L500;
+      break;
+   case 4:
+      e_input_limit = CBQ24250Module::EInputLimit::L900;
+      break;
+   default:
+      /* case 0 or invalid is LHIZ (no override / auto mode) */
+      break;
+   }
+   m_cPowerManagementSystem.SetActuatorInputLimitOverride(e_input_limit);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleSetSubscription(const CPacketControlInterface::CPacket& c_packet) {
+   /* Subscribe to the periodic reply of a request without data */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   uint16_t unPeriod = (punRxData[1] << 8) | punRxData[2];
+   bool bAccepted = false;
+   switch(static_cast<CPacketControlInterface::CPacket::EType>(punRxData[0])) {
+   case CPacketControlInterface::CPacket::EType::GET_UPTIME:
+   case CPacketControlInterface::CPacket::EType::GET_BATT_LVL:
+   case CPacketControlInterface::CPacket::EType::GET_PM_STATUS:
+   case CPacketControlInterface::CPacket::EType::GET_USB_STATUS:
+   case CPacketControlInterface::CPacket::EType::GET_LINK_STATS:
+      bAccepted = m_cPacketControlInterface.SetSubscription(punRxData[0],
+                                                            unPeriod,
+                                                            m_cTimer.GetMilliseconds());
+      break;
+   default:
+      /* not a subscribable packet type */
+      break;
+   }
+   uint8_t punTxData[] = {
+      punRxData[0],
+      uint8_t(bAccepted ? 0x01 : 0x00)
+   };
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::SET_SUBSCRIPTION,
+                                        punTxData,
+                                        sizeof(punTxData));
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleBatch(const CPacketControlInterface::CPacket& c_packet) {
+   /* Execute each sub-packet in order and reply with a single BATCH packet */
+   CPacketControlInterface::CPacket cEntry(0xFF, 0, nullptr);
+   uint8_t unOffset = 0;
+   m_cPacketControlInterface.BeginBatch();
+   while(c_packet.GetBatchEntry(unOffset, cEntry)) {
+      /* nested batches are ignored */
+      if(cEntry.GetType() != CPacketControlInterface::CPacket::EType::BATCH) {
+         ExecutePacket(cEntry);
+      }
+   }
+   m_cPacketControlInterface.EndBatch();
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleSetLinkOptions(const CPacketControlInterface::CPacket& c_packet) {
+   /* Reply with the supported options, then switch to them */
+   uint8_t unLinkOptions = c_packet.GetDataPointer()[0] & SUPPORTED_LINK_OPTIONS;
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::SET_LINK_OPTIONS,
+                                        unLinkOptions);
+   m_cPacketControlInterface.SetLinkOptions(unLinkOptions);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleSetBaudRate(const CPacketControlInterface::CPacket& c_packet) {
+   /* Reply at the current baud rate, then switch to the requested one */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   uint32_t unBaudRate = (static_cast<uint32_t>(punRxData[0]) << 24) |
+                         (static_cast<uint32_t>(punRxData[1]) << 16) |
+                         (static_cast<uint32_t>(punRxData[2]) << 8) |
+                         (static_cast<uint32_t>(punRxData[3]) << 0);
+   bool bSupported = CHUARTController::IsBaudRateSupported(unBaudRate);
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::SET_BAUD_RATE,
+                                        bSupported ? 1 : 0);
+   if(bSupported) {
+      m_cPacketControlInterface.SetBaudRate(unBaudRate, m_cTimer.GetMilliseconds());
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetLinkStats(const CPacketControlInterface::CPacket& c_packet) {
+   /* Requests without data, e.g. from a subscription, do not reset the counters */
+   if(c_packet.GetDataLength() <= 1) {
+      m_cPacketControlInterface.SendLinkStatistics(c_packet.HasData() &&
+                                                   c_packet.GetDataPointer()[0] != 0);
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandlePing(const CPacketControlInterface::CPacket& c_packet) {
+   /* Echo the data, with the receive and transmit times after the flags if requested.
+      The receive time is taken when the frame arrived, not when it was dispatched */
+   uint32_t unRxTime = c_packet.GetArrivalTime();
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   if(!c_packet.HasData() || !(punRxData[0] & PING_FLAG_TIMESTAMPS)) {
+      m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::PING,
+                                           punRxData,
+                                           c_packet.GetDataLength());
+      return;
+   }
+   uint8_t punTxData[MAXIMUM_DATA_LENGTH + PING_TIMESTAMPS_SIZE];
+   uint8_t unTxDataLength = 0;
+   punTxData[unTxDataLength++] = punRxData[0];
+   unTxDataLength += PING_TIMESTAMPS_SIZE;
+   for(uint8_t unIdx = 1; unIdx < c_packet.GetDataLength(); unIdx++) {
+      punTxData[unTxDataLength++] = punRxData[unIdx];
+   }
+   uint32_t punTimes[] = {unRxTime, m_cTimer.GetMicroseconds()};
+   for(uint8_t unIdx = 0; unIdx < PING_TIMESTAMPS_SIZE; unIdx++) {
+      punTxData[1 + unIdx] = (punTimes[unIdx / 4] >> (24 - 8 * (unIdx % 4))) & 0xFF;
+   }
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::PING,
+                                        punTxData,
+                                        unTxDataLength);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleScheduleCommand(const CPacketControlInterface::CPacket& c_packet) {
+   /* Queue the packet that follows the time, Exec executes it once the time is reached */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   bool bAccepted = false;
+   if(c_packet.GetDataLength() >= SCHEDULE_TIME_FIELD_SIZE + TYPE_FIELD_SIZE) {
+      uint32_t unTime = (static_cast<uint32_t>(punRxData[0]) << 24) |
+                        (static_cast<uint32_t>(punRxData[1]) << 16) |
+                        (static_cast<uint32_t>(punRxData[2]) << 8) |
+                        (static_cast<uint32_t>(punRxData[3]) << 0);
+      bAccepted = m_cPacketControlInterface.ScheduleCommand(
+         unTime,
+         punRxData[SCHEDULE_TIME_FIELD_SIZE],
+         &punRxData[SCHEDULE_TIME_FIELD_SIZE + TYPE_FIELD_SIZE],
+         c_packet.GetDataLength() - SCHEDULE_TIME_FIELD_SIZE - TYPE_FIELD_SIZE);
+   }
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::SCHEDULE_COMMAND,
+                                        bAccepted ? 1 : 0);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleAckEvent(const CPacketControlInterface::CPacket& c_packet) {
+   /* Stop repeating the acknowledged event */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   m_cPacketControlInterface.AcknowledgeEvent(punRxData[0], punRxData[1]);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetCapabilities(const CPacketControlInterface::CPacket& c_packet) {
+   uint8_t punTxData[CAPABILITIES_HEADER_SIZE + TYPE_BITMAP_SIZE] = {
+      PROTOCOL_VERSION,
+      BOARD_ID_PM,
+      uint8_t((FIRMWARE_BUILD_HASH >> 24) & 0xFF),
+      uint8_t((FIRMWARE_BUILD_HASH >> 16) & 0xFF),
+      uint8_t((FIRMWARE_BUILD_HASH >> 8 ) & 0xFF),
+      uint8_t((FIRMWARE_BUILD_HASH >> 0 ) & 0xFF)
+   };
+   CCommandRegistry<CFirmware, SCommandTable>::GetTypeBitmap(punTxData + CAPABILITIES_HEADER_SIZE);
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_CAPABILITIES,
+                                        punTxData,
+                                        sizeof(punTxData));
+}
+
+/***********************************************************/
+/***********************************************************/
@@ -16,12 +16,17 @@
 #include <usb_interface_system.h>
 #include <power_management_system.h>
 #include <packet_control_interface.h>
+#include <command_registry.h>
+#include <delta_encoder.h>
 
 #include <adc_controller.h>
 #include <huart_controller.h>
 #include <timer.h>
 #include <tw_controller.h>
 
+/* Number of fields of the GET_PM_STATUS reply */
+#define PM_STATUS_FIELD_COUNT 9
+
 class CFirmware {
 public:
       
@@ -31,10 +36,6 @@ public:
 
    uint8_t GetId();
 
-   void SetFilePointer(FILE* ps_huart) {
-      m_psHUART = ps_huart;
-   }
-
 
    CHUARTController& GetHUARTController() {
       return m_cHUARTController;
@@ -54,6 +55,28 @@ public:
       
 private:
 
+   void ExecutePacket(const CPacketControlInterface::CPacket& c_packet);
+
+   /* Packet handlers, dispatched through SCommandTable */
+   void HandleGetUptime(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetBattLvl(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetSystemPowerEnable(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetActuatorPowerEnable(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetActuatorInputLimitOverride(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetPMStatus(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetUSBStatus(const CPacketControlInterface::CPacket& c_packet);
+   void HandleBatch(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetSubscription(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetLinkOptions(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetBaudRate(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetLinkStats(const CPacketControlInterface::CPacket& c_packet);
+   void HandlePing(const CPacketControlInterface::CPacket& c_packet);
+   void HandleScheduleCommand(const CPacketControlInterface::CPacket& c_packet);
+   void HandleAckEvent(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetCapabilities(const CPacketControlInterface::CPacket& c_packet);
+
+   struct SCommandTable;
+
    /* private constructor */
    CFirmware() :
       m_cTimer(TCCR2A,
@@ -76,6 +99,11 @@ private:
       m_bSystemPowerSignal(false),
       m_bActuatorPowerSignal(false) {
 
+      /* Clock of the timestamps sent with LINK_OPTION_TIMESTAMP */
+      m_cPacketControlInterface.SetClock([] {
+         return CFirmware::GetInstance().GetTimer().GetMicroseconds();
+      });
+
       /* Enable interrupts */
       sei();
 
@@ -94,6 +122,9 @@ private:
 
    CPowerManagementSystem m_cPowerManagementSystem;
 
+   /* Snapshots of the GET_PM_STATUS replies sent as deltas */
+   CDeltaEncoder<PM_STATUS_FIELD_COUNT> m_cPMStatusEncoder;
+
    class CPowerEventInterrupt : public CInterrupt {
    public:
       CPowerEventInterrupt(CFirmware* pc_firmware, 
@@ -125,10 +156,6 @@ private:
 
    static CFirmware _firmware;
 
-public: // TODO, don't make these public
-    /* File structs for fprintf */
-   FILE* m_psHUART;
-
 };
 
 #endif
@@ -24,18 +24,34 @@
 #define HUART_CONTROLLER_H
 
 #include <inttypes.h>
+#include <avr/io.h>
 
-#define SERIAL_BUFFER_SIZE 64
+#include <ring_buffer.h>
+
+/* Sizes of the ring buffers, powers of two of at most 128. The rx buffer is only
+   used when no receiver is set, see SetReceiver */
+#ifndef SERIAL_RX_BUFFER_SIZE
+#define SERIAL_RX_BUFFER_SIZE 16
+#endif
+
+#ifndef SERIAL_TX_BUFFER_SIZE
+#define SERIAL_TX_BUFFER_SIZE 64
+#endif
+
+/* Hardware flow control: define HUART_RTS_PORT, HUART_RTS_DDR and HUART_RTS_MASK in
+   FIRMWARE_CONFIG, e.g. -DHUART_RTS_PORT=PORTD -DHUART_RTS_DDR=DDRD -DHUART_RTS_MASK=0x10,
+   for an output wired to the CTS input of the host. Software flow control is not
+   offered, as XON and XOFF are valid bytes of the binary frames */
+
+#ifndef DEFAULT_BAUD_RATE
+#define DEFAULT_BAUD_RATE 57600
+#endif
 
 class CHUARTController // public CInputStream, public COutputStream { // BASIC! contains only ring buffer
 {
 public:
-   struct SRingBuffer
-   {
-      uint8_t buffer[SERIAL_BUFFER_SIZE];
-      volatile unsigned int head;
-      volatile unsigned int tail;
-   };
+   using CRxBuffer = CRingBuffer<SERIAL_RX_BUFFER_SIZE>;
+   using CTxBuffer = CRingBuffer<SERIAL_TX_BUFFER_SIZE>;
 
    static CHUARTController& instance() {
       return _hardware_serial;
@@ -43,16 +59,78 @@ public:
 
    void Begin(unsigned long);
    void End();
-   virtual int Available(void);
-   virtual int Peek(void);
-   virtual uint8_t Read(void);
-   virtual void Flush(void);
 
-   virtual uint8_t Write(uint8_t);
+   unsigned long GetBaudRate() const {
+      return _baud;
+   }
+
+   /* true if the baud rate can be generated from F_CPU in double speed mode
+      with an error of less than 2.5% */
+   static bool IsBaudRateSupported(unsigned long baud);
+
+   int Available(void);
+   int Peek(void);
+   uint8_t Read(void);
+   void Flush(void);
+
+   uint8_t Write(uint8_t);
+
+   /* non-blocking bulk transfers: ReadBlock returns the number of bytes read,
+      WriteBlock writes all bytes or returns false if they do not fit */
+   uint8_t ReadBlock(uint8_t* pun_data, uint8_t un_length);
+   bool WriteBlock(const uint8_t* pun_data, uint8_t un_length);
+
+   /* non-blocking alternative to Write: Reserve returns false if there is not
+      enough space in the tx buffer, otherwise the reserved bytes are filled with
+      WriteReserved and handed to the transmit interrupt at once by Commit */
+   uint8_t GetTxBufferSpace() {
+     return _tx_buffer->GetSpace();
+   }
+   bool Reserve(uint8_t un_length);
+   void WriteReserved(uint8_t un_byte) {
+     _tx_buffer->WriteAt(_tx_reserved++, un_byte);
+   }
+   void Commit();
+
+   /* when a receiver is set, it is passed each received byte from the
+      receive interrupt instead of the byte being stored in the rx buffer */
+   class CReceiver {
+   public:
+      virtual void Receive(uint8_t un_rx_byte) = 0;
+   };
+
+   void SetReceiver(CReceiver* pc_receiver);
+
+   /* drives the RTS output high to stop the host from sending, without hardware
+     flow control this does nothing. The caller disables the interrupts */
+   void SetReadyToReceive(bool b_ready) {
+#ifdef HUART_RTS_PORT
+     if (b_ready) {
+       HUART_RTS_PORT &= ~HUART_RTS_MASK;
+     }
+     else {
+       HUART_RTS_PORT |= HUART_RTS_MASK;
+     }
+#endif
+   }
+
+   /* counters of the receive interrupt */
+   struct SRxStatistics {
+      uint16_t Bytes;
+      /* bytes dropped because the rx buffer was full */
+      uint16_t BufferOverruns;
+      /* hardware data overruns (DOR0), frame errors (FE0) and parity errors (UPE0) */
+      uint16_t DataOverruns;
+      uint16_t FrameErrors;
+      uint16_t ParityErrors;
+   };
+
+   /* copies the counters and resets them if b_reset is true */
+   void GetRxStatistics(SRxStatistics& s_statistics, bool b_reset);
 
 private:
-   SRingBuffer *_rx_buffer;
-   SRingBuffer *_tx_buffer;
+   CRxBuffer *_rx_buffer;
+   CTxBuffer *_tx_buffer;
    volatile uint8_t *_ubrrh;
    volatile uint8_t *_ubrrl;
    volatile uint8_t *_ucsra;
@@ -64,7 +142,10 @@ private:
    uint8_t _rxcie;
    uint8_t _udrie;
    uint8_t _u2x;
+   unsigned long _baud;
    bool transmitting;
+   /* number of reserved bytes written to the tx buffer */
+   uint8_t _tx_reserved;
 
 
 private:
@@ -0,0 +1,58 @@
+#include "log.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/***********************************************************/
+/***********************************************************/
+
+CLog CLog::m_cLog;
+
+/***********************************************************/
+/***********************************************************/
+
+void CLog::Write(const uint8_t* pun_record, uint8_t un_length) {
+   uint8_t unSREG = SREG;
+   cli();
+   if(!m_cBuffer.WriteBlock(pun_record, un_length) && m_unDroppedCount != 0xFF) {
+      m_unDroppedCount++;
+   }
+   SREG = unSREG;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+uint8_t CLog::Peek(uint8_t* pun_buffer, uint8_t un_length) const {
+   uint8_t unDroppedCount = m_unDroppedCount;
+   if(m_cBuffer.IsEmpty() && unDroppedCount == 0) {
+      return 0;
+   }
+   pun_buffer[0] = unDroppedCount;
+   uint8_t unEnd = 1 + m_cBuffer.Peek(pun_buffer + 1, un_length - 1);
+   /* the last record can be incomplete */
+   uint8_t unLength = 1;
+   while(unLength < unEnd) {
+      uint8_t unRecordLength =
+         1 + GetArgumentCount(static_cast<EMessage>(pun_buffer[unLength]));
+      if(unLength + unRecordLength > unEnd) {
+         break;
+      }
+      unLength += unRecordLength;
+   }
+   return unLength;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CLog::Remove(const uint8_t* pun_buffer, uint8_t un_length) {
+   m_cBuffer.Discard(un_length - 1);
+   uint8_t unSREG = SREG;
+   cli();
+   m_unDroppedCount -= pun_buffer[0];
+   SREG = unSREG;
+}
+
+/***********************************************************/
+/***********************************************************/
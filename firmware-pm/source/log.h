@@ -0,0 +1,75 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+#include <ring_buffer.h>
+
+/* Length of the buffer of the log records, a power of two of at most 128 */
+#ifndef LOG_BUFFER_LENGTH
+#define LOG_BUFFER_LENGTH 32
+#endif
+
+/*
+ * Tokenised log. A record is the id of a message in log_messages.def followed
+ * by its arguments as raw bytes, the host formats it with the same table.
+ * The records are buffered and sent in LOG packets while the link is idle,
+ * see CPacketControlInterface::SendLog. Writing a record only copies a few
+ * bytes, so the log can stay enabled in timing sensitive code and interrupts.
+ */
+class CLog {
+
+public:
+   enum class EMessage : uint8_t {
+#define LOG_MESSAGE(ID, ARGUMENT_COUNT, FORMAT) ID,
+#include <log_messages.def>
+#undef LOG_MESSAGE
+   };
+
+public:
+   static CLog& GetInstance() {
+      return m_cLog;
+   }
+
+   /* Writes a record, if the buffer is full the record is dropped and counted */
+   template<EMessage E_MESSAGE, class... ARGUMENTS>
+   void Write(ARGUMENTS... t_arguments) {
+      static_assert(sizeof...(ARGUMENTS) == GetArgumentCount(E_MESSAGE),
+                    "the number of arguments does not match log_messages.def");
+      const uint8_t punRecord[] = {
+         static_cast<uint8_t>(E_MESSAGE),
+         static_cast<uint8_t>(t_arguments)...
+      };
+      Write(punRecord, sizeof(punRecord));
+   }
+
+   /* Copies the number of dropped records followed by the whole records that fit
+      into un_length bytes of pun_buffer. Returns the number of bytes copied, or
+      zero if there is nothing to send */
+   uint8_t Peek(uint8_t* pun_buffer, uint8_t un_length) const;
+
+   /* Removes the records returned by Peek and resets the number of dropped records */
+   void Remove(const uint8_t* pun_buffer, uint8_t un_length);
+
+   static constexpr uint8_t GetArgumentCount(EMessage e_message) {
+      return
+#define LOG_MESSAGE(ID, ARGUMENT_COUNT, FORMAT) (e_message == EMessage::ID) ? ARGUMENT_COUNT :
+#include <log_messages.def>
+#undef LOG_MESSAGE
+         0;
+   }
+
+private:
+   CLog() :
+      m_unDroppedCount(0) {}
+
+   void Write(const uint8_t* pun_record, uint8_t un_length);
+
+   static CLog m_cLog;
+
+   /* the writers are serialised by disabling the interrupts */
+   CRingBuffer<LOG_BUFFER_LENGTH> m_cBuffer;
+   volatile uint8_t m_unDroppedCount;
+};
+
+#endif
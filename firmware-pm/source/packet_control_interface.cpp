@@ -3,136 +3,14 @@
 
 #include "packet_control_interface.h"
 
+#include <util/crc16.h>
+
 /***********************************************************/
 /***********************************************************/
 
 CPacketControlInterface::CPacket::EType CPacketControlInterface::CPacket::GetType() const {
-   switch(m_unTypeId) {
-   /* up time and voltage */
-   case 0x00:
-      return EType::GET_UPTIME;
-      break;
-   case 0x01:
-      return EType::GET_BATT_LVL;
-      break;
-   /* differential drive system */
-   case 0x10:
-      return EType::SET_DDS_ENABLE;
-      break;
-   case 0x11:
-      return EType::SET_DDS_SPEED;
-      break;
-   case 0x13:
-      return EType::GET_DDS_SPEED;
-      break;
-   case 0x14:
-      return EType::SET_DDS_PARAMS;
-      break;
-   case 0x15:
-      return EType::GET_DDS_PARAMS;
-      break;
-   /* power management */
-   case 0x39:
-      return EType::SET_SYSTEM_POWER_ENABLE;
-      break;
-   case 0x40:
-      return EType::SET_ACTUATOR_POWER_ENABLE;
-      break;
-   case 0x41:
-      return EType::SET_ACTUATOR_INPUT_LIMIT_OVERRIDE;
-      break;
-   case 0x42:
-      return EType::SET_USBIF_ENABLE;
-      break;
-   case 0x43:
-      return EType::REQ_SOFT_PWDN;
-      break;
-   case 0x44:
-      return EType::GET_PM_STATUS;
-      break;
-   case 0x45:
-      return EType::GET_USB_STATUS;
-      break;
-   /* manipulator module */
-   case 0x60:
-      return EType::GET_CHARGER_STATUS;
-      break;
-   case 0x70:
-      return EType::SET_LIFT_ACTUATOR_POSITION;
-      break;      
-   case 0x71:
-      return EType::GET_LIFT_ACTUATOR_POSITION;
-      break;      
-   case 0x72:
-      return EType::SET_LIFT_ACTUATOR_SPEED;
-      break;
-   case 0x73:
-      return EType::GET_LIMIT_SWITCH_STATE;
-      break;
-   case 0x74:
-      return EType::CALIBRATE_LIFT_ACTUATOR;
-      break;
-   case 0x75:
-      return EType::EMER_STOP_LIFT_ACTUATOR;
-      break;
-   case 0x76:
-      return EType::GET_LIFT_ACTUATOR_STATE;
-      break;
-   case 0x80:
-      return EType::SET_EM_CHARGE_ENABLE;
-      break;
-   case 0x81:
-      return EType::SET_EM_DISCHARGE_MODE;
-      break;
-   case 0x82:
-      return EType::GET_EM_ACCUM_VOLTAGE;
-      break;
-   case 0x90:
-      return EType::GET_RF_RANGE;
-      break;
-   case 0x91:
-      return EType::GET_RF_AMBIENT;
-      break;
-   case 0xA0:
-      return EType::READ_NFC;
-      break;
-   case 0xA1:
-      return EType::WRITE_NFC;
-      break;
-   case 0xC0:
-      return EType::READ_SMBUS_BYTE;
-      break;
-   case 0xC1:
-      return EType::READ_SMBUS_BYTE_DATA;
-      break;
-   case 0xC2:
-      return EType::READ_SMBUS_WORD_DATA;
-      break;
-   case 0xC3:
-      return EType::READ_SMBUS_BLOCK_DATA;
-      break;
-   case 0xC4:
-      return EType::READ_SMBUS_I2C_BLOCK_DATA;
-      break;
-   case 0xD0:
-      return EType::WRITE_SMBUS_BYTE;
-      break;
-   case 0xD1:
-      return EType::WRITE_SMBUS_BYTE_DATA;
-      break;
-   case 0xD2:
-      return EType::WRITE_SMBUS_WORD_DATA;
-      break;
-   case 0xD3:
-      return EType::WRITE_SMBUS_BLOCK_DATA;
-      break;
-   case 0xD4:
-      return EType::WRITE_SMBUS_I2C_BLOCK_DATA;
-      break;
-   default:
-      return EType::INVALID;
-      break;
-   }
+   /* type ids without a command are rejected by the command registry */
+   return static_cast<EType>(m_unTypeId);
 }
 
 /***********************************************************/
@@ -159,149 +37,1347 @@ const uint8_t* CPacketControlInterface::CPacket::GetDataPointer() const {
 /***********************************************************/
 /***********************************************************/
 
+uint32_t CPacketControlInterface::CPacket::GetArrivalTime() const {
+   return m_unArrivalTime;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+uint32_t CPacketControlInterface::CPacket::GetDispatchTime() const {
+   return m_unDispatchTime;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CPacketControlInterface::CPacket::GetBatchEntry(uint8_t& un_offset, CPacket& c_entry) const {
+   /* each record requires at least the type and the length fields */
+   if(un_offset + TYPE_FIELD_SIZE + DATA_LENGTH_FIELD_SIZE > m_unDataLength)
+      return false;
+   uint8_t unEntryDataLength = m_punData[un_offset + TYPE_FIELD_SIZE];
+   if(un_offset + TYPE_FIELD_SIZE + DATA_LENGTH_FIELD_SIZE + unEntryDataLength > m_unDataLength)
+      return false;
+   c_entry = CPacket(m_punData[un_offset],
+                     unEntryDataLength,
+                     &m_punData[un_offset + TYPE_FIELD_SIZE + DATA_LENGTH_FIELD_SIZE],
+                     m_unArrivalTime,
+                     m_unDispatchTime);
+   un_offset += TYPE_FIELD_SIZE + DATA_LENGTH_FIELD_SIZE + unEntryDataLength;
+   return true;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::SetUrgentPacketHandler(CUrgentPacketHandler* pc_urgent_packet_handler) {
+   uint8_t unSREG = SREG;
+   cli();
+   m_pcUrgentPacketHandler = pc_urgent_packet_handler;
+   SREG = unSREG;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::SetClock(uint32_t (*fn_get_microseconds)()) {
+   m_fnGetMicroseconds = fn_get_microseconds;
+}
+
+/***********************************************************/
+/***********************************************************/
+
 CPacketControlInterface::EState CPacketControlInterface::GetState() const {
-   return m_eState;
+   return m_bPacketHeld ? EState::RECV_COMMAND : m_cFrameReceiver.GetState();
+}
+
+/***********************************************************/
+/***********************************************************/
+
+uint16_t CPacketControlInterface::GetOverflowCount() const {
+   uint8_t unSREG = SREG;
+   cli();
+   uint16_t unOverflowCount = m_unRxOverflowCount;
+   SREG = unSREG;
+   return unOverflowCount;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CPacketControlInterface::SendLinkStatistics(bool b_reset) {
+   CHUARTController::SRxStatistics sRxStatistics;
+   m_cController.GetRxStatistics(sRxStatistics, false);
+   uint8_t unSREG = SREG;
+   cli();
+   uint16_t punCounters[] = {
+      sRxStatistics.Bytes,
+      m_unRxFrameCount,
+      m_unRxChecksumErrorCount,
+      m_unRxDiscardedCount,
+      m_unRxOverflowCount,
+      sRxStatistics.BufferOverruns,
+      sRxStatistics.DataOverruns,
+      sRxStatistics.FrameErrors,
+      sRxStatistics.ParityErrors
+   };
+   SREG = unSREG;
+   uint8_t punTxData[sizeof(punCounters)];
+   for(uint8_t unIdx = 0; unIdx < sizeof(punCounters) / sizeof(punCounters[0]); unIdx++) {
+      punTxData[2 * unIdx] = (punCounters[unIdx] >> 8) & 0xFF;
+      punTxData[2 * unIdx + 1] = (punCounters[unIdx] >> 0) & 0xFF;
+   }
+   if(!SendPacket(CPacket::EType::GET_LINK_STATS, punTxData, sizeof(punTxData))) {
+      return false;
+   }
+   if(b_reset) {
+      /* the events that occurred since the counters were read are lost */
+      m_cController.GetRxStatistics(sRxStatistics, true);
+      unSREG = SREG;
+      cli();
+      m_unRxFrameCount = 0;
+      m_unRxChecksumErrorCount = 0;
+      m_unRxDiscardedCount = 0;
+      m_unRxOverflowCount = 0;
+      SREG = unSREG;
+   }
+   return true;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CPacketControlInterface::SendPacket(CPacket::EType e_type,
+                                         const uint8_t* pun_tx_data,
+                                         uint8_t un_tx_data_length) {
+
+   if(m_bBatchOpen && e_type != CPacket::EType::BATCH) {
+      uint8_t unRecordLength = TYPE_FIELD_SIZE + DATA_LENGTH_FIELD_SIZE + un_tx_data_length;
+      if(m_unBatchLength + unRecordLength > GetMaximumTxDataLength()) {
+         if(!FlushBatch()) {
+            return false;
+         }
+      }
+      if(unRecordLength <= GetMaximumTxDataLength()) {
+         m_punBatchBuffer[m_unBatchLength++] = static_cast<uint8_t>(e_type);
+         m_punBatchBuffer[m_unBatchLength++] = un_tx_data_length;
+         for(uint8_t unIdx = 0; unIdx < un_tx_data_length; unIdx++)
+            m_punBatchBuffer[m_unBatchLength++] = pun_tx_data[unIdx];
+         return true;
+      }
+      /* the record is too long to be batched, send it on its own */
+   }
+
+   /* the held reply goes first */
+   if(!SendHeldReply()) {
+      return false;
+   }
+
+   /* the first fragment starts with the packet type */
+   uint8_t punHeader[] = {0, static_cast<uint8_t>(e_type)};
+   if(un_tx_data_length > GetMaximumTxDataLength()) {
+      /* the train is only started if the fragments that do not fit can be held, so
+         that an incomplete train is never left on the wire */
+      uint8_t unTxSpace = m_cController.GetTxBufferSpace();
+      uint8_t unOffset = 0;
+      for(uint8_t unHeaderLength = 2; unOffset < un_tx_data_length; unHeaderLength = 1) {
+         uint8_t unFragmentLength = GetMaximumTxDataLength() - unHeaderLength;
+         if(unFragmentLength > un_tx_data_length - unOffset) {
+            unFragmentLength = un_tx_data_length - unOffset;
+         }
+         uint8_t unFrameLength = GetFrameLength(unHeaderLength + unFragmentLength);
+         if(unFrameLength > unTxSpace) {
+            break;
+         }
+         unTxSpace -= unFrameLength;
+         unOffset += unFragmentLength;
+      }
+      if(unOffset < un_tx_data_length &&
+         (!m_bHoldReplies || un_tx_data_length - unOffset > HELD_REPLY_LENGTH)) {
+         return false;
+      }
+      /* the transmit buffer may have drained in the meantime */
+      unOffset = WriteFragments(punHeader, pun_tx_data, un_tx_data_length);
+      if(unOffset < un_tx_data_length) {
+         HoldReply(true, punHeader, pun_tx_data + unOffset, un_tx_data_length - unOffset);
+      }
+      return true;
+   }
+   if(WriteFrame(e_type, nullptr, 0, pun_tx_data, un_tx_data_length)) {
+      return true;
+   }
+   if(!m_bHoldReplies || un_tx_data_length > HELD_REPLY_LENGTH) {
+      return false;
+   }
+   HoldReply(false, punHeader, pun_tx_data, un_tx_data_length);
+   return true;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+uint8_t CPacketControlInterface::WriteFragments(uint8_t* pun_header,
+                                                const uint8_t* pun_tx_data,
+                                                uint8_t un_tx_data_length) {
+   uint8_t unOffset = 0;
+   while(unOffset < un_tx_data_length) {
+      uint8_t unHeaderLength = (pun_header[0] == 0) ? 2 : 1;
+      uint8_t unFragmentLength = GetMaximumTxDataLength() - unHeaderLength;
+      if(unFragmentLength >= un_tx_data_length - unOffset) {
+         unFragmentLength = un_tx_data_length - unOffset;
+         pun_header[0] |= FRAGMENT_LAST;
+      }
+      if(!WriteFrame(CPacket::EType::FRAGMENT, pun_header, unHeaderLength,
+                     pun_tx_data + unOffset, unFragmentLength)) {
+         break;
+      }
+      unOffset += unFragmentLength;
+      pun_header[0]++;
+   }
+   return unOffset;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::HoldReply(bool b_fragmented,
+                                        const uint8_t* pun_header,
+                                        const uint8_t* pun_tx_data,
+                                        uint8_t un_tx_data_length) {
+   /* the frames are tagged and cached when they are written */
+   m_sHeldReply.Tag = m_unReplyTag;
+   m_sHeldReply.Capture = m_psReplyCapture;
+   m_sHeldReply.Fragmented = b_fragmented;
+   m_sHeldReply.Header[0] = pun_header[0];
+   m_sHeldReply.Header[1] = pun_header[1];
+   m_sHeldReply.Length = un_tx_data_length;
+   for(uint8_t unIdx = 0; unIdx < un_tx_data_length; unIdx++) {
+      m_sHeldReply.Data[unIdx] = pun_tx_data[unIdx];
+   }
+   m_bReplyHeld = true;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CPacketControlInterface::SendHeldReply() {
+   if(!m_bReplyHeld) {
+      return true;
+   }
+   /* WriteFrame refuses any other frame while the reply is held */
+   m_bReplyHeld = false;
+   uint8_t unReplyTag = m_unReplyTag;
+   SReply* psReplyCapture = m_psReplyCapture;
+   m_unReplyTag = m_sHeldReply.Tag;
+   m_psReplyCapture = m_sHeldReply.Capture;
+   if(m_sHeldReply.Fragmented) {
+      uint8_t unOffset = WriteFragments(m_sHeldReply.Header,
+                                        m_sHeldReply.Data,
+                                        m_sHeldReply.Length);
+      m_sHeldReply.Length -= unOffset;
+      for(uint8_t unIdx = 0; unIdx < m_sHeldReply.Length; unIdx++) {
+         m_sHeldReply.Data[unIdx] = m_sHeldReply.Data[unOffset + unIdx];
+      }
+      m_bReplyHeld = (m_sHeldReply.Length != 0);
+   }
+   else {
+      m_bReplyHeld = !WriteFrame(static_cast<CPacket::EType>(m_sHeldReply.Header[1]),
+                                 nullptr, 0,
+                                 m_sHeldReply.Data,
+                                 m_sHeldReply.Length);
+   }
+   /* the capture ends if the reply is too long to be cached */
+   m_sHeldReply.Capture = m_psReplyCapture;
+   m_unReplyTag = unReplyTag;
+   m_psReplyCapture = psReplyCapture;
+   return !m_bReplyHeld;
 }
 
 /***********************************************************/
 /***********************************************************/
 
-void CPacketControlInterface::SendPacket(CPacket::EType e_type,
+bool CPacketControlInterface::WriteFrame(CPacket::EType e_type,
+                                         const uint8_t* pun_header,
+                                         uint8_t un_header_length,
                                          const uint8_t* pun_tx_data,
                                          uint8_t un_tx_data_length) {
+   bool bUseCRC = (m_unLinkOptions & LINK_OPTION_CRC);
+   bool bUseCOBS = (m_unLinkOptions & LINK_OPTION_COBS);
+   uint8_t unDataLength = un_header_length + un_tx_data_length;
+   uint8_t unFrameLength = GetFrameLength(unDataLength);
+
+   if(m_bReplyHeld || !m_cController.Reserve(unFrameLength)) {
+      return false;
+   }
+
+   /* in COBS mode, the fields are collected and encoded once the frame is complete */
+   uint8_t punFields[TX_COMMAND_BUFFER_LENGTH - PREAMBLE_SIZE - POSTAMBLE_SIZE];
+   uint8_t unFieldsLength = 0;
+   uint8_t unChecksum = 0;
+   uint16_t unCRC = CRC_INITIAL_VALUE;
+   auto fnWriteField = [&] (uint8_t un_byte) {
+      if(bUseCOBS) {
+         punFields[unFieldsLength++] = un_byte;
+      }
+      else {
+         WriteReserved(un_byte);
+      }
+   };
+   auto fnWrite = [&] (uint8_t un_byte) {
+      unChecksum += un_byte;
+      unCRC = _crc_xmodem_update(unCRC, un_byte);
+      fnWriteField(un_byte);
+   };
+
+   if(!bUseCOBS) {
+      WriteReserved(PREAMBLE1);
+      WriteReserved(PREAMBLE2);
+   }
+   if(bUseCRC) {
+      fnWrite(m_unTxSequence++);
+   }
+   if(m_unLinkOptions & LINK_OPTION_TAG) {
+      fnWrite(m_unReplyTag);
+   }
+   if(m_unLinkOptions & LINK_OPTION_TIMESTAMP) {
+      uint32_t unTime = m_fnGetMicroseconds();
+      fnWrite((unTime >> 24) & 0xFF);
+      fnWrite((unTime >> 16) & 0xFF);
+      fnWrite((unTime >> 8) & 0xFF);
+      fnWrite((unTime >> 0) & 0xFF);
+   }
+   fnWrite(static_cast<uint8_t>(e_type));
+   fnWrite(unDataLength);
+   for(uint8_t unIdx = 0; unIdx < un_header_length; unIdx++) {
+      fnWrite(pun_header[unIdx]);
+   }
+   for(uint8_t unIdx = 0; unIdx < un_tx_data_length; unIdx++) {
+      fnWrite(pun_tx_data[unIdx]);
+   }
+   if(bUseCRC) {
+      fnWriteField((unCRC >> 8) & 0xFF);
+      fnWriteField((unCRC >> 0) & 0xFF);
+   }
+   else {
+      fnWriteField(unChecksum);
+   }
+   if(bUseCOBS) {
+      WriteEncoded(punFields, unFieldsLength);
+   }
+   else {
+      WriteReserved(POSTAMBLE1);
+      WriteReserved(POSTAMBLE2);
+   }
+
+   /* hand the complete frame to the transmit interrupt */
+   m_cController.Commit();
+   return true;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+uint8_t CPacketControlInterface::GetFrameLength(uint8_t un_data_length) const {
+   uint8_t unFrameLength = TX_COMMAND_BUFFER_LENGTH - GetMaximumTxDataLength() + un_data_length;
+   if(m_unLinkOptions & LINK_OPTION_COBS) {
+      unFrameLength += COBS_OVERHEAD_SIZE - PREAMBLE_SIZE - POSTAMBLE_SIZE;
+   }
+   return unFrameLength;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::WriteEncoded(const uint8_t* pun_fields, uint8_t un_fields_length) {
+   static_assert(TX_COMMAND_BUFFER_LENGTH < COBS_MAXIMUM_BLOCK_CODE,
+                 "frames must fit into a single COBS block");
+   /* each zero byte ends a block, which is replaced by the code byte in front of it */
+   uint8_t unBlockStart = 0;
+   for(uint8_t unIdx = 0; unIdx <= un_fields_length; unIdx++) {
+      if(unIdx == un_fields_length || pun_fields[unIdx] == COBS_DELIMITER) {
+         WriteReserved(unIdx - unBlockStart + 1);
+         for(; unBlockStart < unIdx; unBlockStart++) {
+            WriteReserved(pun_fields[unBlockStart]);
+         }
+         unBlockStart = unIdx + 1;
+      }
+   }
+   WriteReserved(COBS_DELIMITER);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::WriteReserved(uint8_t un_byte) {
+   m_cController.WriteReserved(un_byte);
+   if(m_psReplyCapture != nullptr) {
+      if(m_psReplyCapture->Length < REPLY_CACHE_LENGTH) {
+         m_psReplyCapture->Data[m_psReplyCapture->Length++] = un_byte;
+      }
+      else {
+         /* the reply is too long to be cached */
+         m_psReplyCapture->Length = REPLY_NOT_CACHED;
+         m_psReplyCapture = nullptr;
+      }
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::CaptureReply(uint8_t un_sequence) {
+   static_assert(REPLY_CACHE_LENGTH < REPLY_NOT_CACHED,
+                 "the length of a cached reply must be below REPLY_NOT_CACHED");
+   /* replace the reply to the oldest request */
+   m_psReplyCapture = &m_psReplyCache[m_unReplyCacheNext];
+   m_psReplyCapture->Sequence = un_sequence;
+   m_psReplyCapture->Length = 0;
+   if(++m_unReplyCacheNext == REPLY_CACHE_SIZE) {
+      m_unReplyCacheNext = 0;
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CPacketControlInterface::ResendReply(uint8_t un_sequence) {
+   for(const SReply& sReply : m_psReplyCache) {
+      if(sReply.Sequence == un_sequence && sReply.Length != REPLY_NOT_CACHED) {
+         /* the frames are sent as they were, with their sequence numbers and timestamps */
+         return (!m_bReplyHeld && m_cController.WriteBlock(sReply.Data, sReply.Length));
+      }
+   }
+   return true;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::BeginBatch() {
+   m_bBatchOpen = true;
+   m_unBatchLength = 0;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CPacketControlInterface::EndBatch() {
+   /* the last BATCH packet is always sent, even if empty, so that the host
+      receives a reply for every batch */
+   bool bSent = SendPacket(CPacket::EType::BATCH, m_punBatchBuffer, m_unBatchLength);
+   m_bBatchOpen = false;
+   m_unBatchLength = 0;
+   return bSent;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CPacketControlInterface::FlushBatch() {
+   if(m_unBatchLength != 0) {
+      if(!SendPacket(CPacket::EType::BATCH, m_punBatchBuffer, m_unBatchLength)) {
+         return false;
+      }
+      m_unBatchLength = 0;
+   }
+   return true;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CPacketControlInterface::SetSubscription(uint8_t un_type_id,
+                                              uint16_t un_period_ms,
+                                              uint32_t un_time_ms) {
+   SSubscription* psFreeSubscription = nullptr;
+   for(SSubscription& sSubscription : m_psSubscriptions) {
+      if(sSubscription.Period == 0) {
+         if(psFreeSubscription == nullptr) {
+            psFreeSubscription = &sSubscription;
+         }
+      }
+      else if(sSubscription.TypeId == un_type_id) {
+         /* update or remove the existing subscription */
+         sSubscription.Period = un_period_ms;
+         sSubscription.Deadline = un_time_ms + un_period_ms;
+         return true;
+      }
+   }
+   if(un_period_ms == 0) {
+      /* not subscribed */
+      return true;
+   }
+   if(psFreeSubscription == nullptr) {
+      return false;
+   }
+   psFreeSubscription->TypeId = un_type_id;
+   psFreeSubscription->Period = un_period_ms;
+   psFreeSubscription->Deadline = un_time_ms + un_period_ms;
+   return true;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CPacketControlInterface::GetDueSubscription(uint32_t un_time_ms, CPacket& c_packet) {
+   for(SSubscription& sSubscription : m_psSubscriptions) {
+      /* the signed difference handles the wrap around of the time */
+      if(sSubscription.Period != 0 &&
+         static_cast<int32_t>(un_time_ms - sSubscription.Deadline) >= 0) {
+         sSubscription.Deadline += sSubscription.Period;
+         if(static_cast<int32_t>(un_time_ms - sSubscription.Deadline) >= 0) {
+            /* more than one period behind, skip the missed replies */
+            sSubscription.Deadline = un_time_ms + sSubscription.Period;
+         }
+         uint32_t unTime = (m_fnGetMicroseconds != nullptr) ? m_fnGetMicroseconds() : 0;
+         c_packet = CPacket(sSubscription.TypeId, 0, nullptr, unTime, unTime);
+         /* the replies of a subscription are not tagged or cached */
+         m_unReplyTag = 0;
+         m_psReplyCapture = nullptr;
+         m_bHoldReplies = true;
+         return true;
+      }
+   }
+   return false;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CPacketControlInterface::ScheduleCommand(uint32_t un_time_us,
+                                              uint8_t un_type_id,
+                                              const uint8_t* pun_data,
+                                              uint8_t un_data_length) {
+   if(m_unScheduledCommandCount == SCHEDULE_QUEUE_SIZE || un_data_length > SCHEDULED_DATA_LENGTH) {
+      return false;
+   }
+   /* insert the command after the commands that are due before or at the same time */
+   uint8_t unIndex = m_unScheduledCommandCount;
+   while(unIndex > 0 &&
+         static_cast<int32_t>(un_time_us - m_psScheduledCommands[unIndex - 1].Time) < 0) {
+      m_psScheduledCommands[unIndex] = m_psScheduledCommands[unIndex - 1];
+      unIndex--;
+   }
+   SScheduledCommand& sScheduledCommand = m_psScheduledCommands[unIndex];
+   sScheduledCommand.Time = un_time_us;
+   sScheduledCommand.TypeId = un_type_id;
+   sScheduledCommand.DataLength = un_data_length;
+   for(uint8_t unIdx = 0; unIdx < un_data_length; unIdx++) {
+      sScheduledCommand.Data[unIdx] = pun_data[unIdx];
+   }
+   m_unScheduledCommandCount++;
+   return true;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CPacketControlInterface::GetDueCommand(uint32_t un_time_us, CPacket& c_packet) {
+   DiscardStaleCommands();
+   /* the signed difference handles the wrap around of the time */
+   if(m_unScheduledCommandCount == 0 ||
+      static_cast<int32_t>(un_time_us - m_psScheduledCommands[0].Time) < 0) {
+      return false;
+   }
+   m_sDueCommand = m_psScheduledCommands[0];
+   m_unScheduledCommandCount--;
+   for(uint8_t unIdx = 0; unIdx < m_unScheduledCommandCount; unIdx++) {
+      m_psScheduledCommands[unIdx] = m_psScheduledCommands[unIdx + 1];
+   }
+   c_packet = CPacket(m_sDueCommand.TypeId,
+                      m_sDueCommand.DataLength,
+                      m_sDueCommand.Data,
+                      m_sDueCommand.Time,
+                      un_time_us);
+   /* the replies of a scheduled command are not tagged or cached */
+   m_unReplyTag = 0;
+   m_psReplyCapture = nullptr;
+   m_bHoldReplies = true;
+   return true;
+}
+
+/***********************************************************/
+/***********************************************************/
 
-   uint8_t punTxBuffer[TX_COMMAND_BUFFER_LENGTH];
-   uint8_t unTxBufferPointer = 0;
-   /* Check if the data will fit into the buffer */
-   if(un_tx_data_length + NON_DATA_SIZE > TX_COMMAND_BUFFER_LENGTH)
+void CPacketControlInterface::DiscardStaleCommands() {
+   uint8_t unStopCount = m_unStopCount;
+   if(unStopCount != m_unHandledStopCount) {
+      /* the commands were scheduled and the fragments received before the stop */
+      m_unHandledStopCount = unStopCount;
+      m_unScheduledCommandCount = 0;
+      m_unFragmentIndex = 0;
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CPacketControlInterface::PostEvent(uint8_t un_type_id,
+                                        const uint8_t* pun_data,
+                                        uint8_t un_data_length) {
+   if(un_data_length > EVENT_DATA_LENGTH) {
+      return false;
+   }
+   SEvent* psEvent = nullptr;
+   for(SEvent& sEvent : m_psEvents) {
+      if(sEvent.Used && sEvent.TypeId == un_type_id) {
+         psEvent = &sEvent;
+         break;
+      }
+      if(!sEvent.Used && psEvent == nullptr) {
+         psEvent = &sEvent;
+      }
+   }
+   if(psEvent == nullptr) {
+      return false;
+   }
+   if(!psEvent->Used) {
+      psEvent->Used = true;
+      psEvent->TypeId = un_type_id;
+      psEvent->Unacknowledged = false;
+      /* the first event is not delayed by the minimum interval */
+      psEvent->LastSent = m_unEventTime - EVENT_MINIMUM_INTERVAL;
+   }
+   /* replace an event that was not sent yet */
+   psEvent->DataLength = un_data_length;
+   for(uint8_t unIdx = 0; unIdx < un_data_length; unIdx++) {
+      psEvent->Data[unIdx] = pun_data[unIdx];
+   }
+   psEvent->Pending = true;
+   return true;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::SendEvents(uint32_t un_time_ms) {
+   m_unEventTime = un_time_ms;
+   bool bUseAck = (m_unLinkOptions & LINK_OPTION_EVENT_ACK);
+   /* events are not replies */
+   uint8_t unReplyTag = m_unReplyTag;
+   SReply* psReplyCapture = m_psReplyCapture;
+   bool bHoldReplies = m_bHoldReplies;
+   m_unReplyTag = 0;
+   m_psReplyCapture = nullptr;
+   m_bHoldReplies = false;
+   for(SEvent& sEvent : m_psEvents) {
+      if(!sEvent.Used) {
+         continue;
+      }
+      uint32_t unElapsed = un_time_ms - sEvent.LastSent;
+      if(unElapsed < EVENT_MINIMUM_INTERVAL) {
+         continue;
+      }
+      if(!sEvent.Pending &&
+         !(bUseAck && sEvent.Unacknowledged && unElapsed >= EVENT_RETRANSMIT_PERIOD)) {
+         continue;
+      }
+      uint8_t unSequence = sEvent.Pending ? sEvent.Sequence + 1 : sEvent.Sequence;
+      bool bSent;
+      if(bUseAck) {
+         uint8_t punHeader[] = {sEvent.TypeId, unSequence};
+         bSent = WriteFrame(CPacket::EType::EVENT, punHeader, sizeof(punHeader),
+                            sEvent.Data, sEvent.DataLength);
+      }
+      else {
+         bSent = SendPacket(static_cast<CPacket::EType>(sEvent.TypeId),
+                            sEvent.Data, sEvent.DataLength);
+      }
+      /* if the transmit buffer is full, the event is retried on the next call */
+      if(bSent) {
+         sEvent.Sequence = unSequence;
+         sEvent.Pending = false;
+         sEvent.Unacknowledged = bUseAck;
+         sEvent.LastSent = un_time_ms;
+      }
+   }
+   m_unReplyTag = unReplyTag;
+   m_psReplyCapture = psReplyCapture;
+   m_bHoldReplies = bHoldReplies;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::AcknowledgeEvent(uint8_t un_type_id, uint8_t un_sequence) {
+   for(SEvent& sEvent : m_psEvents) {
+      /* an acknowledgement of a replaced event is ignored */
+      if(sEvent.Used && sEvent.TypeId == un_type_id && sEvent.Sequence == un_sequence) {
+         sEvent.Unacknowledged = false;
+      }
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::SendLog(CLog& c_log) {
+   if(m_unRxQueueTail != m_unRxQueueHead || m_bReplyHeld ||
+      m_cController.GetTxBufferSpace() != SERIAL_TX_BUFFER_SIZE - 1) {
+      return;
+   }
+   uint8_t punTxData[TX_COMMAND_BUFFER_LENGTH];
+   uint8_t unTxDataLength = c_log.Peek(punTxData, GetMaximumTxDataLength());
+   if(unTxDataLength == 0) {
       return;
+   }
+   /* the log is not a reply */
+   uint8_t unReplyTag = m_unReplyTag;
+   SReply* psReplyCapture = m_psReplyCapture;
+   bool bHoldReplies = m_bHoldReplies;
+   m_unReplyTag = 0;
+   m_psReplyCapture = nullptr;
+   m_bHoldReplies = false;
+   if(SendPacket(CPacket::EType::LOG, punTxData, unTxDataLength)) {
+      c_log.Remove(punTxData, unTxDataLength);
+   }
+   m_unReplyTag = unReplyTag;
+   m_psReplyCapture = psReplyCapture;
+   m_bHoldReplies = bHoldReplies;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+uint8_t CPacketControlInterface::SetLinkOptions(uint8_t un_link_options) {
+   /* the held reply, e.g. the reply to the change, is sent with the previous options */
+   while(!SendHeldReply());
+   uint8_t unSREG = SREG;
+   cli();
+   m_unLinkOptions = un_link_options & SUPPORTED_LINK_OPTIONS;
+   if(m_fnGetMicroseconds == nullptr) {
+      m_unLinkOptions &= ~LINK_OPTION_TIMESTAMP;
+   }
+   /* the frame being received started with the previous options */
+   m_cFrameReceiver.Reset();
+   m_unRxWindowBase = 0;
+   m_unRxWindowMask = 0;
+   m_unAckFrameCount = 0;
+   m_bResendPending = false;
+   SREG = unSREG;
+   m_bAckDeadlineSet = false;
+   m_unTxSequence = 0;
+   m_unReplyTag = 0;
+   /* the cached replies belong to the previous sequence numbers */
+   m_psReplyCapture = nullptr;
+   for(SReply& sReply : m_psReplyCache) {
+      sReply.Length = REPLY_NOT_CACHED;
+   }
+   return m_unLinkOptions;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::SetBaudRate(uint32_t un_baud_rate, uint32_t un_time_ms) {
+   uint32_t unBaudRate = m_cController.GetBaudRate();
+   ChangeBaudRate(un_baud_rate);
+   /* keep the baud rate that was confirmed last if the previous change is still pending */
+   if(m_unFallbackBaudRate == 0) {
+      m_unFallbackBaudRate = unBaudRate;
+   }
+   m_unBaudRateDeadline = un_time_ms + BAUD_RATE_FALLBACK_TIMEOUT;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::CheckBaudRate(uint32_t un_time_ms) {
+   if(m_unFallbackBaudRate != 0) {
+      if(m_bFrameReceived) {
+         /* the host is using the new baud rate */
+         m_unFallbackBaudRate = 0;
+      }
+      else if(static_cast<int32_t>(un_time_ms - m_unBaudRateDeadline) >= 0) {
+         ChangeBaudRate(m_unFallbackBaudRate);
+         m_unFallbackBaudRate = 0;
+      }
+   }
+}
 
-   punTxBuffer[unTxBufferPointer++] = PREAMBLE1;
-   punTxBuffer[unTxBufferPointer++] = PREAMBLE2;
-   punTxBuffer[unTxBufferPointer++] = static_cast<uint8_t>(e_type);
-   punTxBuffer[unTxBufferPointer++] = un_tx_data_length;
-   while(unTxBufferPointer < DATA_START_OFFSET + un_tx_data_length) {
-      punTxBuffer[unTxBufferPointer] = pun_tx_data[unTxBufferPointer - DATA_START_OFFSET];
-      unTxBufferPointer++;
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::ChangeBaudRate(uint32_t un_baud_rate) {
+   /* the held reply, e.g. the reply to the change, is sent at the previous baud rate */
+   while(!SendHeldReply());
+   m_cController.Flush();
+   uint8_t unSREG = SREG;
+   cli();
+   m_cController.Begin(un_baud_rate);
+   /* the frame being received started at the previous baud rate */
+   m_cFrameReceiver.Reset();
+   m_bFrameReceived = false;
+   SREG = unSREG;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+uint8_t CPacketControlInterface::GetMaximumTxDataLength() const {
+   uint8_t unMaximumTxDataLength = TX_COMMAND_BUFFER_LENGTH - NON_DATA_SIZE;
+   if(m_unLinkOptions & LINK_OPTION_CRC) {
+      unMaximumTxDataLength -= CRC_MODE_EXTRA_SIZE;
+   }
+   if(m_unLinkOptions & LINK_OPTION_TAG) {
+      unMaximumTxDataLength -= TAG_FIELD_SIZE;
    }
-   punTxBuffer[unTxBufferPointer++] = ComputeChecksum(punTxBuffer, TX_COMMAND_BUFFER_LENGTH);
-   punTxBuffer[unTxBufferPointer++] = POSTAMBLE1;
-   punTxBuffer[unTxBufferPointer++] = POSTAMBLE2;
+   if(m_unLinkOptions & LINK_OPTION_TIMESTAMP) {
+      unMaximumTxDataLength -= TIMESTAMP_FIELD_SIZE;
+   }
+   return unMaximumTxDataLength;
+}
+
+/***********************************************************/
+/***********************************************************/
 
-   for(uint8_t unIdx = 0; unIdx < unTxBufferPointer; unIdx++)
-      m_cController.Write(punTxBuffer[unIdx]);
+bool CPacketControlInterface::IsInRxWindow(uint8_t un_sequence) const {
+   uint8_t unOffset = un_sequence - m_unRxWindowBase;
+   if(unOffset == 0) {
+      /* the expected frame */
+      return true;
+   }
+   else if(unOffset <= RX_WINDOW_SIZE) {
+      /* a frame after a missing one, executed as soon as it is received */
+      return !(m_unRxWindowMask & (1 << (unOffset - 1)));
+   }
+   else {
+      /* a retransmission of a frame before the window or a frame beyond the window */
+      return false;
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::UpdateRxWindow(uint8_t un_sequence, bool b_skip_missing) {
+   /* any frame received in CRC mode is acknowledged */
+   if(m_unAckFrameCount != 0xFF) {
+      m_unAckFrameCount++;
+   }
+   uint8_t unOffset = un_sequence - m_unRxWindowBase;
+   if(unOffset == 0 || b_skip_missing) {
+      /* slide the window past this frame and all consecutive received frames after it */
+      uint8_t unRxWindowBase = un_sequence + 1;
+      uint8_t unRxWindowMask = m_unRxWindowMask >> unOffset;
+      while(unRxWindowMask & 0x01) {
+         unRxWindowMask >>= 1;
+         unRxWindowBase++;
+      }
+      m_unRxWindowBase = unRxWindowBase;
+      m_unRxWindowMask = unRxWindowMask >> 1;
+   }
+   else {
+      m_unRxWindowMask |= (1 << (unOffset - 1));
+   }
 }
 
 /***********************************************************/
 /***********************************************************/
 
 void CPacketControlInterface::Reset() {
-   m_unRxBufferPointer = 0;
-   m_unUsedBufferLength = 0;
-   m_eState = EState::SRCH_PREAMBLE1;
+   uint8_t unSREG = SREG;
+   cli();
+   /* drop all queued frames and the frame being received */
+   m_unRxQueueHead = 0;
+   m_unRxQueueTail = 0;
+   m_bPacketHeld = false;
+   m_cFrameReceiver.Reset();
+   UpdateFlowControl();
+   SREG = unSREG;
 }
 
 /***********************************************************/
 /***********************************************************/
 
-void CPacketControlInterface::AdjustBuffer() {
-   /* search for the beginning of a new packet */
-   uint8_t unReparseOffset = 1;
-   for(; unReparseOffset < m_unUsedBufferLength; unReparseOffset++)
-      if(m_punRxBuffer[unReparseOffset] == PREAMBLE1)
-         break;
-   /* shift the data so that the new packet is at the beginning of the buffer */
-   for(uint8_t unBufferIdx = unReparseOffset;
-       unBufferIdx < m_unUsedBufferLength;
-       unBufferIdx++)
-      m_punRxBuffer[unBufferIdx - unReparseOffset] = m_punRxBuffer[unBufferIdx];
-   /* reset the state machine */
-   m_unUsedBufferLength -= unReparseOffset;
-   m_unRxBufferPointer = 0;
+void CPacketControlInterface::UpdateFlowControl() {
+   static_assert(RX_FLOW_CONTROL_RESUME_LEVEL < RX_FLOW_CONTROL_STOP_LEVEL &&
+                 RX_FLOW_CONTROL_STOP_LEVEL < RX_FRAME_QUEUE_DEPTH,
+                 "the flow control levels do not fit the frame queue");
+   uint8_t unSREG = SREG;
+   cli();
+   uint8_t unQueuedFrames =
+      (RX_FRAME_QUEUE_DEPTH + m_unRxQueueHead - m_unRxQueueTail) % RX_FRAME_QUEUE_DEPTH;
+   if(unQueuedFrames >= RX_FLOW_CONTROL_STOP_LEVEL) {
+      m_cController.SetReadyToReceive(false);
+   }
+   else if(unQueuedFrames <= RX_FLOW_CONTROL_RESUME_LEVEL) {
+      m_cController.SetReadyToReceive(true);
+   }
+   SREG = unSREG;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::ProcessInput() {
+   uint8_t unRxQueueTail = m_unRxQueueTail;
+   if(m_bPacketHeld) {
+      /* we received a command in the last invocation, release its slot in the queue */
+      if(!m_bPacketReassembled) {
+         if(++unRxQueueTail == RX_FRAME_QUEUE_DEPTH) {
+            unRxQueueTail = 0;
+         }
+         m_unRxQueueTail = unRxQueueTail;
+         UpdateFlowControl();
+      }
+      m_bPacketHeld = false;
+      m_bPacketReassembled = false;
+   }
+   DiscardStaleCommands();
+   /* frames sent from now on are not replies */
+   m_unReplyTag = 0;
+   m_psReplyCapture = nullptr;
+   m_bHoldReplies = false;
+   bool bReplySent = SendHeldReply();
+   /* the queued frames are acknowledged when due, even if the queue does not drain */
+   SendLinkAck();
+   if(!bReplySent) {
+      /* no packet is handed out while a reply is held, the transmit interrupt signals
+         PENDING_WORK_TX once its buffer is empty */
+      return;
+   }
+   while(unRxQueueTail != m_unRxQueueHead) {
+      /* in CRC mode, the frame receiver only queues frames that were not received before */
+      const SFrame& sFrame = m_psRxQueue[unRxQueueTail];
+      if(sFrame.StopCount != m_unStopCount) {
+         /* the frame was received before an urgent packet that stopped the board */
+         if(++unRxQueueTail == RX_FRAME_QUEUE_DEPTH) {
+            unRxQueueTail = 0;
+         }
+         m_unRxQueueTail = unRxQueueTail;
+         UpdateFlowControl();
+         continue;
+      }
+      uint32_t unDispatchTime = (m_fnGetMicroseconds != nullptr) ? m_fnGetMicroseconds() : 0;
+      /* hand out the oldest frame in the queue, the data is not copied */
+      m_cPacket = CPacket(sFrame.Buffer[TYPE_OFFSET - PREAMBLE_SIZE],
+                          sFrame.Buffer[DATA_LENGTH_OFFSET - PREAMBLE_SIZE],
+                          &sFrame.Buffer[DATA_START_OFFSET - PREAMBLE_SIZE],
+                          sFrame.ArrivalTime,
+                          unDispatchTime);
+      if(m_cPacket.GetType() != CPacket::EType::FRAGMENT) {
+         m_unReplyTag = sFrame.Tag;
+         if(m_unLinkOptions & LINK_OPTION_CRC) {
+            CaptureReply(sFrame.Sequence);
+         }
+         m_bHoldReplies = true;
+         m_bPacketHeld = true;
+         /* the next call releases the frame and looks at the rest of the queue */
+         CPendingWork::GetInstance().Set(PENDING_WORK_RX);
+         return;
+      }
+      /* fragments are copied into the reassembly buffer, the tag of the last one is used */
+      if(Reassemble(m_cPacket)) {
+         /* a retransmission of the last fragment gets the reply again */
+         m_unReplyTag = sFrame.Tag;
+         if(m_unLinkOptions & LINK_OPTION_CRC) {
+            CaptureReply(sFrame.Sequence);
+         }
+         m_bHoldReplies = true;
+         m_cPacket = CPacket(m_unFragmentType,
+                             m_unFragmentLength,
+                             m_punFragmentBuffer,
+                             m_unFragmentArrivalTime,
+                             unDispatchTime);
+         m_bPacketHeld = true;
+         m_bPacketReassembled = true;
+         CPendingWork::GetInstance().Set(PENDING_WORK_RX);
+      }
+      /* release the slot of the fragment */
+      if(++unRxQueueTail == RX_FRAME_QUEUE_DEPTH) {
+         unRxQueueTail = 0;
+      }
+      m_unRxQueueTail = unRxQueueTail;
+      UpdateFlowControl();
+      if(m_bPacketHeld) {
+         return;
+      }
+   }
+   /* the queue is empty, so the request of a retransmitted frame was executed */
+   uint8_t unSREG = SREG;
+   cli();
+   bool bResendPending = m_bResendPending;
+   uint8_t unResendSequence = m_unResendSequence;
+   SREG = unSREG;
+   /* if the reply does not fit, it is sent again on a later call */
+   if(bResendPending && ResendReply(unResendSequence)) {
+      unSREG = SREG;
+      cli();
+      /* keep the request of a frame retransmitted in the meantime */
+      if(m_unResendSequence == unResendSequence) {
+         m_bResendPending = false;
+      }
+      SREG = unSREG;
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::SendLinkAck() {
+   uint8_t unSREG = SREG;
+   cli();
+   uint8_t unAckFrameCount = m_unAckFrameCount;
+   uint8_t punTxData[] = {
+      m_unRxWindowBase,
+      m_unRxWindowMask
+   };
+   SREG = unSREG;
+   if(unAckFrameCount == 0) {
+      return;
+   }
+   /* without a clock, the frames are acknowledged at once */
+   if(unAckFrameCount < LINK_ACK_FRAME_COUNT && m_fnGetMicroseconds != nullptr) {
+      uint32_t unTime = m_fnGetMicroseconds();
+      if(!m_bAckDeadlineSet) {
+         m_bAckDeadlineSet = true;
+         m_unAckDeadline = unTime + LINK_ACK_DELAY;
+      }
+      if(static_cast<int32_t>(unTime - m_unAckDeadline) < 0) {
+         return;
+      }
+   }
+   /* acknowledge all frames received since the last acknowledgement at once, if the
+      acknowledgement cannot be sent, it is retried on the next call */
+   if(SendPacket(CPacket::EType::LINK_ACK, punTxData, sizeof(punTxData))) {
+      /* the frames received while sending are acknowledged by the next one */
+      unSREG = SREG;
+      cli();
+      m_unAckFrameCount -= unAckFrameCount;
+      SREG = unSREG;
+      m_bAckDeadlineSet = false;
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CPacketControlInterface::Reassemble(const CPacket& c_fragment) {
+   const uint8_t* punFragment = c_fragment.GetDataPointer();
+   uint8_t unDataOffset = 1;
+   if(!c_fragment.HasData()) {
+      m_unFragmentIndex = 0;
+      return false;
+   }
+   uint8_t unIndex = punFragment[0] & FRAGMENT_INDEX_MASK;
+   if(unIndex == 0) {
+      /* the first fragment, drop any incomplete packet */
+      if(c_fragment.GetDataLength() < 2) {
+         m_unFragmentIndex = 0;
+         return false;
+      }
+      m_unFragmentType = punFragment[1];
+      m_unFragmentLength = 0;
+      m_unFragmentArrivalTime = c_fragment.GetArrivalTime();
+      unDataOffset = 2;
+   }
+   else if(unIndex != m_unFragmentIndex) {
+      /* a fragment is missing, drop the packet */
+      m_unFragmentIndex = 0;
+      return false;
+   }
+   if(m_unFragmentLength + c_fragment.GetDataLength() - unDataOffset > FRAGMENT_BUFFER_LENGTH) {
+      /* the packet is too long */
+      m_unFragmentIndex = 0;
+      return false;
+   }
+   for(uint8_t unIdx = unDataOffset; unIdx < c_fragment.GetDataLength(); unIdx++) {
+      m_punFragmentBuffer[m_unFragmentLength++] = punFragment[unIdx];
+   }
+   if(punFragment[0] & FRAGMENT_LAST) {
+      m_unFragmentIndex = 0;
+      return true;
+   }
+   m_unFragmentIndex = unIndex + 1;
+   return false;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::CFrameReceiver::Reset() {
+   m_unFrameBytes = 0;
+   if(m_pcPacketControlInterface->m_unLinkOptions & LINK_OPTION_COBS) {
+      /* COBS frames have no preamble, start with the fields that follow it */
+      m_unRxIndex = PREAMBLE_SIZE;
+      m_unChecksum = 0;
+      m_unCRC = CRC_INITIAL_VALUE;
+      m_unCobsCode = 0;
+      m_bCobsZero = false;
+      m_eState = EState::SRCH_POSTAMBLE1;
+   }
+   else {
+      m_unRxIndex = 0;
+      m_eState = EState::SRCH_PREAMBLE1;
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CPacketControlInterface::CFrameReceiver::Resynchronise(uint8_t un_rx_byte) {
+   /* the bytes of the rejected frame are not rescanned, but the current byte
+      can still be the beginning of the next frame */
+   m_unRxIndex = 0;
    m_eState = EState::SRCH_PREAMBLE1;
+   /* in COBS mode, the rest of the frame is ignored until the next delimiter */
+   if(!(m_pcPacketControlInterface->m_unLinkOptions & LINK_OPTION_COBS) &&
+      un_rx_byte == PREAMBLE1) {
+      m_unRxIndex = 1;
+      m_eState = EState::SRCH_PREAMBLE2;
+      CaptureArrivalTime();
+   }
+   /* all bytes of the rejected frame are discarded, except the beginning of the next one */
+   m_pcPacketControlInterface->m_unRxDiscardedCount += m_unFrameBytes - m_unRxIndex;
+   m_unFrameBytes = m_unRxIndex;
 }
 
 /***********************************************************/
 /***********************************************************/
 
-void CPacketControlInterface::ReceiveFrame(uint8_t *pun_data, uint8_t un_length) {
-   /* check if the checksum are valid */
-   uint8_t unCheckSum = ComputeChecksum(pun_data, RX_COMMAND_BUFFER_LENGTH);
-   if(pun_data[un_length + CHECKSUM_OFFSET] == unCheckSum){
-      /* At this point we assume we have a valid command */
-      m_eState = EState::RECV_COMMAND;
-      /* Populate the packet fields */
-      m_cPacket = CPacket(m_punRxBuffer[TYPE_OFFSET],
-                          m_punRxBuffer[DATA_LENGTH_OFFSET],
-                          &m_punRxBuffer[DATA_START_OFFSET]);
+/* Reminder: this method is called from the USART receive interrupt */
+void CPacketControlInterface::CFrameReceiver::Accumulate(uint8_t un_rx_byte, bool b_use_crc) {
+   if(b_use_crc) {
+      m_unCRC = _crc_xmodem_update(m_unCRC, un_rx_byte);
+   }
+   else {
+      m_unChecksum += un_rx_byte;
    }
 }
 
-void CPacketControlInterface::ProcessInput() {
-   uint8_t unRxByte = 0;
-   if(m_eState == EState::RECV_COMMAND) {
-      /* we received a command in the last invocation, prepare for the next one */
-      AdjustBuffer();
-   }
-
-   while(m_eState != EState::RECV_COMMAND) {
-      /* if data is available (from port or from reparsing) process it */
-      if(m_unRxBufferPointer < m_unUsedBufferLength) {
-         unRxByte = m_punRxBuffer[m_unRxBufferPointer];
-         m_unRxBufferPointer++;
-      }     
-      else if(m_cController.Available()) {
-         unRxByte = m_cController.Read();
-         m_punRxBuffer[m_unRxBufferPointer++] = unRxByte;
-         m_unUsedBufferLength++;
+/***********************************************************/
+/***********************************************************/
+
+/* Reminder: this method is called from the USART receive interrupt */
+void CPacketControlInterface::CFrameReceiver::CaptureArrivalTime() {
+   if(m_pcPacketControlInterface->m_fnGetMicroseconds != nullptr) {
+      m_pcPacketControlInterface->m_psRxQueue[m_pcPacketControlInterface->m_unRxQueueHead].ArrivalTime =
+         m_pcPacketControlInterface->m_fnGetMicroseconds();
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+/* Reminder: this method is called from the USART receive interrupt */
+void CPacketControlInterface::CFrameReceiver::Receive(uint8_t un_rx_byte) {
+   m_unFrameBytes++;
+   if(m_pcPacketControlInterface->m_unLinkOptions & LINK_OPTION_COBS) {
+      Decode(un_rx_byte);
+   }
+   else {
+      Step(un_rx_byte);
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+/* Reminder: this method is called from the USART receive interrupt */
+void CPacketControlInterface::CFrameReceiver::Decode(uint8_t un_rx_byte) {
+   if(un_rx_byte == COBS_DELIMITER) {
+      /* the delimiter takes the place of the postamble, the frame is only committed
+         if its last block and its checksum or CRC are complete */
+      if(m_eState == EState::SRCH_POSTAMBLE1 && m_unCobsCode == 0) {
+         Step(POSTAMBLE1);
+         Step(POSTAMBLE2);
+      }
+      /* a committed frame has reset the byte count, a lone delimiter is not counted */
+      if(m_unFrameBytes > 1) {
+         m_pcPacketControlInterface->m_unRxDiscardedCount += m_unFrameBytes;
+      }
+      Reset();
+   }
+   else if(m_eState == EState::SRCH_POSTAMBLE1) {
+      if(m_unCobsCode == 0) {
+         /* the first code byte after a delimiter starts the frame */
+         if(m_unFrameBytes == 1) {
+            CaptureArrivalTime();
+         }
+         /* a code byte, the previous block is followed by a zero unless it was full */
+         if(m_bCobsZero) {
+            Step(0x00);
+         }
+         m_unCobsCode = un_rx_byte - 1;
+         m_bCobsZero = (un_rx_byte != COBS_MAXIMUM_BLOCK_CODE);
       }
       else {
-         /* no data available, break out of this loop */
-         break;
+         m_unCobsCode--;
+         Step(un_rx_byte);
       }
-      /* step the state machine */
-      switch(m_eState) {
-      case EState::SRCH_PREAMBLE1:
-         if(unRxByte != PREAMBLE1) {
-            AdjustBuffer();
+   }
+   else {
+      /* the rest of a rejected frame */
+      m_pcPacketControlInterface->m_unRxDiscardedCount++;
+      m_unFrameBytes = 0;
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+/* Reminder: this method is called from the USART receive interrupt */
+void CPacketControlInterface::CFrameReceiver::Step(uint8_t un_rx_byte) {
+   uint8_t unRxIndex = m_unRxIndex++;
+   /* the frame is written into the slot at the head of the queue */
+   SFrame& sFrame =
+      m_pcPacketControlInterface->m_psRxQueue[m_pcPacketControlInterface->m_unRxQueueHead];
+   uint8_t* punFrame = sFrame.Buffer;
+   bool bUseCRC = (m_pcPacketControlInterface->m_unLinkOptions & LINK_OPTION_CRC);
+   /* step the state machine */
+   switch(m_eState) {
+   case EState::SRCH_PREAMBLE1:
+      if(un_rx_byte != PREAMBLE1) {
+         Resynchronise(un_rx_byte);
+      }
+      else {
+         m_eState = EState::SRCH_PREAMBLE2;
+         CaptureArrivalTime();
+      }
+      break;
+   case EState::SRCH_PREAMBLE2:
+      if(un_rx_byte != PREAMBLE2) {
+         Resynchronise(un_rx_byte);
+      }
+      else {
+         m_unChecksum = 0;
+         m_unCRC = CRC_INITIAL_VALUE;
+         m_eState = EState::SRCH_POSTAMBLE1;
+      }
+      break;
+   case EState::SRCH_POSTAMBLE1:
+      if(bUseCRC) {
+         if(unRxIndex == SEQUENCE_OFFSET) {
+            sFrame.Sequence = un_rx_byte;
+            Accumulate(un_rx_byte, bUseCRC);
+            break;
          }
-         else {
-            m_eState = EState::SRCH_PREAMBLE2;
+         /* the remaining fields follow the sequence number */
+         unRxIndex -= SEQUENCE_FIELD_SIZE;
+      }
+      if(m_pcPacketControlInterface->m_unLinkOptions & LINK_OPTION_TAG) {
+         if(unRxIndex == TYPE_OFFSET) {
+            sFrame.Tag = un_rx_byte;
+            Accumulate(un_rx_byte, bUseCRC);
+            break;
          }
-         break;
-      case EState::SRCH_PREAMBLE2:
-         if(unRxByte != PREAMBLE2) {
-            AdjustBuffer();
+         /* the remaining fields follow the tag */
+         unRxIndex -= TAG_FIELD_SIZE;
+      }
+      /* store the frame and accumulate the checksum while searching for the postamble */
+      if(unRxIndex == TYPE_OFFSET) {
+         punFrame[unRxIndex - PREAMBLE_SIZE] = un_rx_byte;
+         Accumulate(un_rx_byte, bUseCRC);
+      }
+      else if(unRxIndex == DATA_LENGTH_OFFSET) {
+         if(un_rx_byte + NON_DATA_SIZE + (bUseCRC ? CRC_MODE_EXTRA_SIZE : 0) +
+            ((m_pcPacketControlInterface->m_unLinkOptions & LINK_OPTION_TAG) ? TAG_FIELD_SIZE : 0) >
+            RX_COMMAND_BUFFER_LENGTH) {
+            /* the declared length is longer than any valid packet */
+            Resynchronise(un_rx_byte);
          }
          else {
-            m_eState = EState::SRCH_POSTAMBLE1;
+            punFrame[unRxIndex - PREAMBLE_SIZE] = un_rx_byte;
+            Accumulate(un_rx_byte, bUseCRC);
          }
-         break;
-      case EState::SRCH_POSTAMBLE1:
-         /* check pointer position with the packet length declared in the packet */
-         if(m_unRxBufferPointer > DATA_LENGTH_OFFSET &&
-            m_unRxBufferPointer == m_punRxBuffer[DATA_LENGTH_OFFSET] + NON_DATA_SIZE - 1) {
-            if(unRxByte != POSTAMBLE1) {
-               /* reached the packet's declared length but the postamble is missing */
-               AdjustBuffer();
+      }
+      else if(unRxIndex < DATA_START_OFFSET + punFrame[DATA_LENGTH_OFFSET - PREAMBLE_SIZE]) {
+         punFrame[unRxIndex - PREAMBLE_SIZE] = un_rx_byte;
+         Accumulate(un_rx_byte, bUseCRC);
+      }
+      else {
+         /* position after the data */
+         uint8_t unCheckIndex =
+            unRxIndex - (DATA_START_OFFSET + punFrame[DATA_LENGTH_OFFSET - PREAMBLE_SIZE]);
+         if(bUseCRC && unCheckIndex < CRC_FIELD_SIZE) {
+            /* the CRC is sent MSB first */
+            uint8_t unExpected = (unCheckIndex == 0) ? (m_unCRC >> 8) : (m_unCRC & 0xFF);
+            if(un_rx_byte != unExpected) {
+               m_pcPacketControlInterface->m_unRxChecksumErrorCount++;
+               Resynchronise(un_rx_byte);
             }
-            else {
-               /* unRxByte == POSTAMBLE1 */
-               m_eState = EState::SRCH_POSTAMBLE2;
+         }
+         else if(!bUseCRC && unCheckIndex < CHECKSUM_FIELD_SIZE) {
+            if(un_rx_byte != m_unChecksum) {
+               m_pcPacketControlInterface->m_unRxChecksumErrorCount++;
+               Resynchronise(un_rx_byte);
             }
          }
-         break;
-      case EState::SRCH_POSTAMBLE2:
-         if(m_unRxBufferPointer > DATA_LENGTH_OFFSET &&
-            m_unRxBufferPointer == m_punRxBuffer[DATA_LENGTH_OFFSET] + NON_DATA_SIZE) {
-            if(unRxByte == POSTAMBLE2) {
-               ReceiveFrame(m_punRxBuffer, m_unRxBufferPointer);
+         else if(un_rx_byte != POSTAMBLE1) {
+            /* reached the packet's declared length but the postamble is missing */
+            Resynchronise(un_rx_byte);
+         }
+         else {
+            /* un_rx_byte == POSTAMBLE1 */
+            m_eState = EState::SRCH_POSTAMBLE2;
+         }
+      }
+      break;
+   case EState::SRCH_POSTAMBLE2:
+      if(un_rx_byte != POSTAMBLE2) {
+         Resynchronise(un_rx_byte);
+      }
+      else {
+         /* At this point we have a valid frame */
+         m_pcPacketControlInterface->m_bFrameReceived = true;
+         if(bUseCRC && !m_pcPacketControlInterface->IsInRxWindow(sFrame.Sequence)) {
+            /* a retransmission of a frame that was received already is not executed
+               again. It is acknowledged at once and its reply is sent again */
+            if(m_pcPacketControlInterface->m_unAckFrameCount < LINK_ACK_FRAME_COUNT) {
+               m_pcPacketControlInterface->m_unAckFrameCount = LINK_ACK_FRAME_COUNT;
             }
+            m_pcPacketControlInterface->m_unResendSequence = sFrame.Sequence;
+            m_pcPacketControlInterface->m_bResendPending = true;
          }
-         break;
-      default:
-         break;
+         else if(bUseCRC &&
+                 punFrame[TYPE_OFFSET - PREAMBLE_SIZE] == static_cast<uint8_t>(CPacket::EType::FRAGMENT) &&
+                 sFrame.Sequence != m_pcPacketControlInterface->m_unRxWindowBase) {
+            /* a fragment after a missing frame cannot be reassembled, it is dropped
+               without being acknowledged, so that the host retransmits the rest of
+               the train in order */
+         }
+         else {
+            uint8_t unRxQueueHead = m_pcPacketControlInterface->m_unRxQueueHead;
+            if(++unRxQueueHead == RX_FRAME_QUEUE_DEPTH) {
+               unRxQueueHead = 0;
+            }
+            /* execute it at once if it is urgent, otherwise commit it to the queue if
+               there is space. A dropped frame is not acknowledged */
+            if(m_pcPacketControlInterface->m_pcUrgentPacketHandler != nullptr &&
+               m_pcPacketControlInterface->m_pcUrgentPacketHandler->HandleUrgentPacket(
+                  CPacket(punFrame[TYPE_OFFSET - PREAMBLE_SIZE],
+                          punFrame[DATA_LENGTH_OFFSET - PREAMBLE_SIZE],
+                          &punFrame[DATA_START_OFFSET - PREAMBLE_SIZE],
+                          sFrame.ArrivalTime))) {
+               m_pcPacketControlInterface->m_unRxFrameCount++;
+               /* the queued frames become stale, in CRC mode the window moves past
+                  the missing frames too, so that a retransmission of an earlier
+                  command is not executed after the stop */
+               m_pcPacketControlInterface->m_unStopCount++;
+               if(bUseCRC) {
+                  m_pcPacketControlInterface->UpdateRxWindow(sFrame.Sequence, true);
+               }
+            }
+            else if(unRxQueueHead != m_pcPacketControlInterface->m_unRxQueueTail) {
+               if(bUseCRC) {
+                  m_pcPacketControlInterface->UpdateRxWindow(sFrame.Sequence);
+               }
+               sFrame.StopCount = m_pcPacketControlInterface->m_unStopCount;
+               m_pcPacketControlInterface->m_unRxQueueHead = unRxQueueHead;
+               m_pcPacketControlInterface->m_unRxFrameCount++;
+               m_pcPacketControlInterface->UpdateFlowControl();
+            }
+            else {
+               m_pcPacketControlInterface->m_unRxOverflowCount++;
+            }
+         }
+         CPendingWork::GetInstance().Set(PENDING_WORK_RX);
+         Reset();
       }
+      break;
+   default:
+      break;
    }
 }
 
@@ -337,17 +1413,3 @@ const char* CPacketControlInterface::StateToString(CPacketControlInterface::ESta
 const CPacketControlInterface::CPacket& CPacketControlInterface::GetPacket() const {
    return m_cPacket;
 }
-
-/***********************************************************/
-/***********************************************************/
-
-uint8_t CPacketControlInterface::ComputeChecksum(uint8_t* pun_buf_data, uint8_t un_buf_length) {
-   uint8_t unChecksum = 0;
-   for(uint8_t unIdx = TYPE_OFFSET;
-       unIdx < ((DATA_START_OFFSET + pun_buf_data[DATA_LENGTH_OFFSET] > un_buf_length) ?
-          un_buf_length : (DATA_START_OFFSET + pun_buf_data[DATA_LENGTH_OFFSET]));
-       unIdx++) {
-      unChecksum += pun_buf_data[unIdx];
-   }
-   return unChecksum;
-}
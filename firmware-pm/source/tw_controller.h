@@ -31,10 +31,43 @@
 #define TW_STATE_READY 0
 #define TW_STATE_MRX   1
 #define TW_STATE_MTX   2
+#define TW_STATE_QUEUE 3
 
 #define TW_BUS_NO_ERROR 0xFF
 
+/* Results of EndTransmission and of the queued transactions */
+#define TW_RESULT_SUCCESS 0
+#define TW_RESULT_ADDRESS_NACK 2
+#define TW_RESULT_DATA_NACK 3
+#define TW_RESULT_ERROR 4
+#define TW_RESULT_PENDING 0xFF
+
 class CTWController {
+public:
+   struct STransaction;
+
+   /* Handler called from the TWI interrupt when a queued transaction is complete.
+      It can submit transactions, including the one it was called with */
+   class CTransactionHandler {
+   public:
+      virtual void HandleTransaction(STransaction& s_transaction) = 0;
+   };
+
+   /* Transaction for Submit: WriteLength bytes of Buffer are written to the device,
+      then ReadLength bytes are read from it into Buffer, after a repeated start if
+      RepeatedStart is set or after a stop and a start otherwise. The descriptor and
+      the buffer belong to the queue until Result is no longer TW_RESULT_PENDING */
+   struct STransaction {
+      uint8_t Address;
+      uint8_t* Buffer;
+      uint8_t WriteLength;
+      uint8_t ReadLength;
+      bool RepeatedStart;
+      CTransactionHandler* Handler;
+      volatile uint8_t Result;
+      STransaction* Next;
+   };
+
 private:
    uint8_t m_punRxBuffer[TW_BUFFER_LENGTH];
    uint8_t m_unRxBufferIndex;
@@ -56,6 +89,11 @@ public:
 
    uint8_t Read(uint8_t un_address, uint8_t un_length, bool b_send_stop = true);
 
+   /* Queues a transaction without waiting. The interrupt executes the queued
+      transactions back to back, sets their results and calls their handlers.
+      The blocking methods above wait for the queue to be empty */
+   void Submit(STransaction& s_transaction);
+
    virtual bool Available();
    virtual uint8_t Read();
    virtual uint8_t Peek();
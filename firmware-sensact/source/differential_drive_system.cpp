@@ -41,6 +41,9 @@ CDifferentialDriveSystem::CDifferentialDriveSystem() :
               RIGHT_PWM_PIN);
    /* set the direction of the output pins to output */
    DDRB |= (DRV8833_EN);
+   /* the fault output of the driver is open drain, enable the pull up */
+   DDRB &= ~(DRV8833_FAULT);
+   PORTB |= (DRV8833_FAULT);
    DDRD |= (LEFT_MODE_PIN  |
             LEFT_CTRL_PIN  |
             LEFT_PWM_PIN   |
@@ -126,6 +129,14 @@ void CDifferentialDriveSystem::Disable() {
 /****************************************/
 /****************************************/
 
+bool CDifferentialDriveSystem::IsFaulted() {
+   /* the fault output is active low and released while the driver sleeps */
+   return (PORTB & DRV8833_EN) && !(PINB & DRV8833_FAULT);
+}
+
+/****************************************/
+/****************************************/
+
 void CDifferentialDriveSystem::ConfigureLeftMotor(CDifferentialDriveSystem::EBridgeMode e_mode,
                                                   uint8_t un_duty_cycle) {
    switch(e_mode) {
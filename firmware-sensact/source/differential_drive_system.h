@@ -16,6 +16,9 @@ public:
    void Enable();
    void Disable();
 
+   /* true if the enabled motor driver signals an overcurrent or overtemperature fault */
+   bool IsFaulted();
+
 public:
    enum class EBridgeMode {
       COAST,
@@ -7,22 +7,6 @@ CFirmware CFirmware::_firmware;
 /* main function that runs the firmware */
 int main(void)
 {
-   /* FILE structs for fprintf */
-   FILE huart;
-
-   /* Set up FILE structs for fprintf */                           
-   fdev_setup_stream(&huart, 
-                     [](char c_to_write, FILE* pf_stream) {
-                        CFirmware::GetInstance().GetHUARTController().Write(c_to_write);
-                        return 1;
-                     },
-                     [](FILE* pf_stream) {
-                        return int(CFirmware::GetInstance().GetHUARTController().Read());
-                     },
-                     _FDEV_SETUP_RW);
-
-   CFirmware::GetInstance().SetFilePointer(&huart);
-
    /* Execute the firmware */
    CFirmware::GetInstance().Exec();
 
@@ -36,83 +20,362 @@ int main(void)
 void CFirmware::Exec() {
    m_cAccelerometerSystem.Init();
 
+   /* fault of the motor driver reported by the last event */
+   bool bDDSFault = false;
+
    for(;;) {
       m_cPacketControlInterface.ProcessInput();
 
       if(m_cPacketControlInterface.GetState() == CPacketControlInterface::EState::RECV_COMMAND) {
-         CPacketControlInterface::CPacket cPacket = m_cPacketControlInterface.GetPacket();
-         switch(cPacket.GetType()) {
-         case CPacketControlInterface::CPacket::EType::SET_DDS_ENABLE:
-            /* Set the enable signal for the differential drive system */
-            if(cPacket.GetDataLength() == 1) {
-               const uint8_t* punRxData = cPacket.GetDataPointer();
-               if(punRxData[0] == 0) {
-                  m_cDifferentialDriveSystem.Disable();
-               }
-               else {
-                  m_cDifferentialDriveSystem.Enable();
-               }
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::SET_DDS_SPEED:
-            /* Set the speed of the differential drive system */
-            if(cPacket.GetDataLength() == 4) {
-               const uint8_t* punRxData = cPacket.GetDataPointer();
-               int16_t nLeftVelocity, nRightVelocity;
-               reinterpret_cast<uint16_t&>(nLeftVelocity) = (punRxData[0] << 8) | punRxData[1];
-               reinterpret_cast<uint16_t&>(nRightVelocity) = (punRxData[2] << 8) | punRxData[3];
-               m_cDifferentialDriveSystem.SetTargetVelocity(nLeftVelocity, nRightVelocity);
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::GET_DDS_SPEED:
-            if(cPacket.GetDataLength() == 0) {
-               /* Get the speed of the differential drive system */               
-               int16_t nLeftSpeed = m_cDifferentialDriveSystem.GetLeftVelocity();
-               int16_t nRightSpeed = m_cDifferentialDriveSystem.GetRightVelocity();
-               uint8_t punTxData[] {
-                  reinterpret_cast<uint8_t*>(&nLeftSpeed)[1],
-                  reinterpret_cast<uint8_t*>(&nLeftSpeed)[0],
-                  reinterpret_cast<uint8_t*>(&nRightSpeed)[1],
-                  reinterpret_cast<uint8_t*>(&nRightSpeed)[0],
-               };
-               m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_DDS_SPEED,
-                                                    punTxData,
-                                                    sizeof(punTxData));
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::GET_UPTIME:
-            if(cPacket.GetDataLength() == 0) {
-               /* timer not implemented to improve interrupt latency for the shaft encoders */
-               uint8_t punTxData[] = {0, 0, 0, 0};
-               m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_UPTIME,
-                                                    punTxData,
-                                                    4);
-            }
-            break;
-         case CPacketControlInterface::CPacket::EType::GET_ACCEL_READING:
-            if(cPacket.GetDataLength() == 0) {
-               CAccelerometerSystem::SReading sReading = m_cAccelerometerSystem.GetReading();
-               uint8_t punTxData[] = {
-                  uint8_t((sReading.X >> 8) & 0xFF),
-                  uint8_t((sReading.X >> 0) & 0xFF),
-                  uint8_t((sReading.Y >> 8) & 0xFF),
-                  uint8_t((sReading.Y >> 0) & 0xFF),
-                  uint8_t((sReading.Z >> 8) & 0xFF),
-                  uint8_t((sReading.Z >> 0) & 0xFF),
-                  uint8_t((sReading.Temp >> 8) & 0xFF),
-                  uint8_t((sReading.Temp >> 0) & 0xFF),                  
-               };
-               m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_ACCEL_READING,
-                                                    punTxData,
-                                                    sizeof(punTxData));
-            }
-            break;
-         default:
-            /* unknown command */
-            break;
+         ExecutePacket(m_cPacketControlInterface.GetPacket());
+      }
+      /* Generate the requests of the subscriptions that are due */
+      CPacketControlInterface::CPacket cSubscriptionPacket(0xFF, 0, nullptr);
+      if(m_cPacketControlInterface.GetDueSubscription(m_cTimer.GetMilliseconds(), cSubscriptionPacket)) {
+         ExecutePacket(cSubscriptionPacket);
+      }
+      /* Execute the scheduled command that is due */
+      CPacketControlInterface::CPacket cScheduledPacket(0xFF, 0, nullptr);
+      if(m_cPacketControlInterface.GetDueCommand(m_cTimer.GetMicroseconds(), cScheduledPacket)) {
+         ExecutePacket(cScheduledPacket);
+      }
+      /* Restore the previous baud rate if the host did not follow a change */
+      m_cPacketControlInterface.CheckBaudRate(m_cTimer.GetMilliseconds());
+      /* Report the changes of the fault signal of the motor driver */
+      if(m_cDifferentialDriveSystem.IsFaulted() != bDDSFault) {
+         uint8_t unFault = bDDSFault ? 0 : 1;
+         if(m_cPacketControlInterface.PostEvent(static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::GET_DDS_FAULT),
+                                                &unFault, 1)) {
+            bDDSFault = !bDDSFault;
          }
       }
+      /* Send the posted events */
+      m_cPacketControlInterface.SendEvents(m_cTimer.GetMilliseconds());
+      /* Send the log while the link is idle */
+      m_cPacketControlInterface.SendLog(CLog::GetInstance());
+      /* Sleep until an interrupt signals work, scheduled commands are polled so that
+         they are executed at their time and not at the next timer tick */
+      if(!m_cPacketControlInterface.HasScheduledCommands()) {
+         CPendingWork::GetInstance().Wait();
+      }
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+/* Packet handlers and the data length they expect, sorted by type id */
+struct CFirmware::SCommandTable {
+   static constexpr SCommand<CFirmware> Commands[] PROGMEM = {
+      {CPacketControlInterface::CPacket::EType::GET_UPTIME, 0, &CFirmware::HandleGetUptime},
+      {CPacketControlInterface::CPacket::EType::SET_DDS_ENABLE, 1, &CFirmware::HandleSetDDSEnable},
+      {CPacketControlInterface::CPacket::EType::SET_DDS_SPEED, 4, &CFirmware::HandleSetDDSSpeed},
+      {CPacketControlInterface::CPacket::EType::GET_DDS_SPEED, 0, &CFirmware::HandleGetDDSSpeed},
+      {CPacketControlInterface::CPacket::EType::GET_DDS_FAULT, 0, &CFirmware::HandleGetDDSFault},
+      {CPacketControlInterface::CPacket::EType::GET_ACCEL_READING, 0, &CFirmware::HandleGetAccelReading},
+      {CPacketControlInterface::CPacket::EType::BATCH, VARIABLE_DATA_LENGTH, &CFirmware::HandleBatch},
+      {CPacketControlInterface::CPacket::EType::SET_SUBSCRIPTION, 3, &CFirmware::HandleSetSubscription},
+      {CPacketControlInterface::CPacket::EType::SET_LINK_OPTIONS, 1, &CFirmware::HandleSetLinkOptions},
+      {CPacketControlInterface::CPacket::EType::SET_BAUD_RATE, 4, &CFirmware::HandleSetBaudRate},
+      {CPacketControlInterface::CPacket::EType::GET_LINK_STATS, VARIABLE_DATA_LENGTH, &CFirmware::HandleGetLinkStats},
+      {CPacketControlInterface::CPacket::EType::PING, VARIABLE_DATA_LENGTH, &CFirmware::HandlePing},
+      {CPacketControlInterface::CPacket::EType::SCHEDULE_COMMAND, VARIABLE_DATA_LENGTH, &CFirmware::HandleScheduleCommand},
+      {CPacketControlInterface::CPacket::EType::ACK_EVENT, 2, &CFirmware::HandleAckEvent},
+      {CPacketControlInterface::CPacket::EType::GET_CAPABILITIES, 0, &CFirmware::HandleGetCapabilities}
+   };
+};
+
+constexpr SCommand<CFirmware> CFirmware::SCommandTable::Commands[] PROGMEM;
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::ExecutePacket(const CPacketControlInterface::CPacket& c_packet) {
+   /* packets with an unknown type or an invalid data length are ignored */
+   CCommandRegistry<CFirmware, SCommandTable>::Dispatch(*this, c_packet);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+/* Reminder: this method is called from the USART receive interrupt */
+bool CFirmware::CEmergencyStopHandler::HandleUrgentPacket(const CPacketControlInterface::CPacket& c_packet) {
+   /* Execute disable and zero speed requests at once, in place of their handlers */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   switch(c_packet.GetType()) {
+   case CPacketControlInterface::CPacket::EType::SET_DDS_ENABLE:
+      if(c_packet.GetDataLength() == 1 && punRxData[0] == 0) {
+         m_cDifferentialDriveSystem.Disable();
+         return true;
+      }
+      break;
+   case CPacketControlInterface::CPacket::EType::SET_DDS_SPEED:
+      if(c_packet.GetDataLength() == 4 &&
+         (punRxData[0] | punRxData[1] | punRxData[2] | punRxData[3]) == 0) {
+         m_cDifferentialDriveSystem.SetTargetVelocity(0, 0);
+         return true;
+      }
+      break;
+   default:
+      break;
+   }
+   return false;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleSetDDSEnable(const CPacketControlInterface::CPacket& c_packet) {
+   /* Set the enable signal for the differential drive system */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   if(punRxData[0] == 0) {
+      m_cDifferentialDriveSystem.Disable();
+   }
+   else {
+      m_cDifferentialDriveSystem.Enable();
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleSetDDSSpeed(const CPacketControlInterface::CPacket& c_packet) {
+   /* Set the speed of the differential drive system */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   int16_t nLeftVelocity, nRightVelocity;
+   reinterpret_cast<uint16_t&>(nLeftVelocity) = (punRxData[0] << 8) | punRxData[1];
+   reinterpret_cast<uint16_t&>(nRightVelocity) = (punRxData[2] << 8) | punRxData[3];
+   m_cDifferentialDriveSystem.SetTargetVelocity(nLeftVelocity, nRightVelocity);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetDDSSpeed(const CPacketControlInterface::CPacket& c_packet) {
+   /* Get the speed of the differential drive system */               
+   int16_t nLeftSpeed = m_cDifferentialDriveSystem.GetLeftVelocity();
+   int16_t nRightSpeed = m_cDifferentialDriveSystem.GetRightVelocity();
+   uint8_t punTxData[] {
+      reinterpret_cast<uint8_t*>(&nLeftSpeed)[1],
+      reinterpret_cast<uint8_t*>(&nLeftSpeed)[0],
+      reinterpret_cast<uint8_t*>(&nRightSpeed)[1],
+      reinterpret_cast<uint8_t*>(&nRightSpeed)[0],
+   };
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_DDS_SPEED,
+                                        punTxData,
+                                        sizeof(punTxData));
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetDDSFault(const CPacketControlInterface::CPacket& c_packet) {
+   /* Get the fault signal of the motor driver */
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_DDS_FAULT,
+                                        m_cDifferentialDriveSystem.IsFaulted() ? 1 : 0);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetUptime(const CPacketControlInterface::CPacket& c_packet) {
+   uint32_t unUptime = m_cTimer.GetMilliseconds();
+   uint8_t punTxData[] = {
+      uint8_t((unUptime >> 24) & 0xFF),
+      uint8_t((unUptime >> 16) & 0xFF),
+      uint8_t((unUptime >> 8 ) & 0xFF),
+      uint8_t((unUptime >> 0 ) & 0xFF)
+   };
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_UPTIME,
+                                        punTxData,
+                                        sizeof(punTxData));
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetAccelReading(const CPacketControlInterface::CPacket& c_packet) {
+   CAccelerometerSystem::SReading sReading = m_cAccelerometerSystem.GetReading();
+   uint8_t punTxData[] = {
+      uint8_t((sReading.X >> 8) & 0xFF),
+      uint8_t((sReading.X >> 0) & 0xFF),
+      uint8_t((sReading.Y >> 8) & 0xFF),
+      uint8_t((sReading.Y >> 0) & 0xFF),
+      uint8_t((sReading.Z >> 8) & 0xFF),
+      uint8_t((sReading.Z >> 0) & 0xFF),
+      uint8_t((sReading.Temp >> 8) & 0xFF),
+      uint8_t((sReading.Temp >> 0) & 0xFF),                  
+   };
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_ACCEL_READING,
+                                        punTxData,
+                                        sizeof(punTxData));
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleSetSubscription(const CPacketControlInterface::CPacket& c_packet) {
+   /* Subscribe to the periodic reply of a request without data */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   uint16_t unPeriod = (punRxData[1] << 8) | punRxData[2];
+   bool bAccepted = false;
+   switch(static_cast<CPacketControlInterface::CPacket::EType>(punRxData[0])) {
+   case CPacketControlInterface::CPacket::EType::GET_UPTIME:
+   case CPacketControlInterface::CPacket::EType::GET_DDS_SPEED:
+   case CPacketControlInterface::CPacket::EType::GET_DDS_FAULT:
+   case CPacketControlInterface::CPacket::EType::GET_ACCEL_READING:
+   case CPacketControlInterface::CPacket::EType::GET_LINK_STATS:
+      bAccepted = m_cPacketControlInterface.SetSubscription(punRxData[0],
+                                                            unPeriod,
+                                                            m_cTimer.GetMilliseconds());
+      break;
+   default:
+      /* not a subscribable packet type */
+      break;
+   }
+   uint8_t punTxData[] = {
+      punRxData[0],
+      uint8_t(bAccepted ? 0x01 : 0x00)
+   };
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::SET_SUBSCRIPTION,
+                                        punTxData,
+                                        sizeof(punTxData));
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleBatch(const CPacketControlInterface::CPacket& c_packet) {
+   /* Execute each sub-packet in order and reply with a single BATCH packet */
+   CPacketControlInterface::CPacket cEntry(0xFF, 0, nullptr);
+   uint8_t unOffset = 0;
+   m_cPacketControlInterface.BeginBatch();
+   while(c_packet.GetBatchEntry(unOffset, cEntry)) {
+      /* nested batches are ignored */
+      if(cEntry.GetType() != CPacketControlInterface::CPacket::EType::BATCH) {
+         ExecutePacket(cEntry);
+      }
    }
+   m_cPacketControlInterface.EndBatch();
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleSetLinkOptions(const CPacketControlInterface::CPacket& c_packet) {
+   /* Reply with the supported options, then switch to them */
+   uint8_t unLinkOptions = c_packet.GetDataPointer()[0] & SUPPORTED_LINK_OPTIONS;
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::SET_LINK_OPTIONS,
+                                        unLinkOptions);
+   m_cPacketControlInterface.SetLinkOptions(unLinkOptions);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleSetBaudRate(const CPacketControlInterface::CPacket& c_packet) {
+   /* Reply at the current baud rate, then switch to the requested one */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   uint32_t unBaudRate = (static_cast<uint32_t>(punRxData[0]) << 24) |
+                         (static_cast<uint32_t>(punRxData[1]) << 16) |
+                         (static_cast<uint32_t>(punRxData[2]) << 8) |
+                         (static_cast<uint32_t>(punRxData[3]) << 0);
+   bool bSupported = CHUARTController::IsBaudRateSupported(unBaudRate);
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::SET_BAUD_RATE,
+                                        bSupported ? 1 : 0);
+   if(bSupported) {
+      m_cPacketControlInterface.SetBaudRate(unBaudRate, m_cTimer.GetMilliseconds());
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetLinkStats(const CPacketControlInterface::CPacket& c_packet) {
+   /* Requests without data, e.g. from a subscription, do not reset the counters */
+   if(c_packet.GetDataLength() <= 1) {
+      m_cPacketControlInterface.SendLinkStatistics(c_packet.HasData() &&
+                                                   c_packet.GetDataPointer()[0] != 0);
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandlePing(const CPacketControlInterface::CPacket& c_packet) {
+   /* Echo the data, with the receive and transmit times after the flags if requested.
+      The receive time is taken when the frame arrived, not when it was dispatched */
+   uint32_t unRxTime = c_packet.GetArrivalTime();
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   if(!c_packet.HasData() || !(punRxData[0] & PING_FLAG_TIMESTAMPS)) {
+      m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::PING,
+                                           punRxData,
+                                           c_packet.GetDataLength());
+      return;
+   }
+   uint8_t punTxData[MAXIMUM_DATA_LENGTH + PING_TIMESTAMPS_SIZE];
+   uint8_t unTxDataLength = 0;
+   punTxData[unTxDataLength++] = punRxData[0];
+   unTxDataLength += PING_TIMESTAMPS_SIZE;
+   for(uint8_t unIdx = 1; unIdx < c_packet.GetDataLength(); unIdx++) {
+      punTxData[unTxDataLength++] = punRxData[unIdx];
+   }
+   uint32_t punTimes[] = {unRxTime, m_cTimer.GetMicroseconds()};
+   for(uint8_t unIdx = 0; unIdx < PING_TIMESTAMPS_SIZE; unIdx++) {
+      punTxData[1 + unIdx] = (punTimes[unIdx / 4] >> (24 - 8 * (unIdx % 4))) & 0xFF;
+   }
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::PING,
+                                        punTxData,
+                                        unTxDataLength);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleScheduleCommand(const CPacketControlInterface::CPacket& c_packet) {
+   /* Queue the packet that follows the time, Exec executes it once the time is reached */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   bool bAccepted = false;
+   if(c_packet.GetDataLength() >= SCHEDULE_TIME_FIELD_SIZE + TYPE_FIELD_SIZE) {
+      uint32_t unTime = (static_cast<uint32_t>(punRxData[0]) << 24) |
+                        (static_cast<uint32_t>(punRxData[1]) << 16) |
+                        (static_cast<uint32_t>(punRxData[2]) << 8) |
+                        (static_cast<uint32_t>(punRxData[3]) << 0);
+      bAccepted = m_cPacketControlInterface.ScheduleCommand(
+         unTime,
+         punRxData[SCHEDULE_TIME_FIELD_SIZE],
+         &punRxData[SCHEDULE_TIME_FIELD_SIZE + TYPE_FIELD_SIZE],
+         c_packet.GetDataLength() - SCHEDULE_TIME_FIELD_SIZE - TYPE_FIELD_SIZE);
+   }
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::SCHEDULE_COMMAND,
+                                        bAccepted ? 1 : 0);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleAckEvent(const CPacketControlInterface::CPacket& c_packet) {
+   /* Stop repeating the acknowledged event */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   m_cPacketControlInterface.AcknowledgeEvent(punRxData[0], punRxData[1]);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CFirmware::HandleGetCapabilities(const CPacketControlInterface::CPacket& c_packet) {
+   uint8_t punTxData[CAPABILITIES_HEADER_SIZE + TYPE_BITMAP_SIZE] = {
+      PROTOCOL_VERSION,
+      BOARD_ID_SENSACT,
+      uint8_t((FIRMWARE_BUILD_HASH >> 24) & 0xFF),
+      uint8_t((FIRMWARE_BUILD_HASH >> 16) & 0xFF),
+      uint8_t((FIRMWARE_BUILD_HASH >> 8 ) & 0xFF),
+      uint8_t((FIRMWARE_BUILD_HASH >> 0 ) & 0xFF)
+   };
+   CCommandRegistry<CFirmware, SCommandTable>::GetTypeBitmap(punTxData + CAPABILITIES_HEADER_SIZE);
+   m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_CAPABILITIES,
+                                        punTxData,
+                                        sizeof(punTxData));
 }
 
 /***********************************************************/
@@ -13,7 +13,9 @@
 /* Firmware Headers */
 #include <huart_controller.h>
 #include <tw_controller.h>
+#include <timer.h>
 #include <packet_control_interface.h>
+#include <command_registry.h>
 
 #include <differential_drive_system.h>
 #include <accelerometer_system.h>
@@ -24,10 +26,6 @@ public:
       return _firmware;
    }
 
-   void SetFilePointer(FILE* ps_huart) {
-      m_psHUART = ps_huart;
-   }
-
    CHUARTController& GetHUARTController() {
       return m_cHUARTController;
    }
@@ -36,20 +34,78 @@ public:
       return m_cTWController;
    }
 
+   CTimer& GetTimer() {
+      return m_cTimer;
+   }
+
    void Exec();
 
 private:
 
+   void ExecutePacket(const CPacketControlInterface::CPacket& c_packet);
+
+   /* Packet handlers, dispatched through SCommandTable */
+   void HandleGetUptime(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetDDSEnable(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetDDSSpeed(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetDDSSpeed(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetDDSFault(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetAccelReading(const CPacketControlInterface::CPacket& c_packet);
+   void HandleBatch(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetSubscription(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetLinkOptions(const CPacketControlInterface::CPacket& c_packet);
+   void HandleSetBaudRate(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetLinkStats(const CPacketControlInterface::CPacket& c_packet);
+   void HandlePing(const CPacketControlInterface::CPacket& c_packet);
+   void HandleScheduleCommand(const CPacketControlInterface::CPacket& c_packet);
+   void HandleAckEvent(const CPacketControlInterface::CPacket& c_packet);
+   void HandleGetCapabilities(const CPacketControlInterface::CPacket& c_packet);
+
+   struct SCommandTable;
+
+   /* Stops the differential drive system from the receive interrupt */
+   class CEmergencyStopHandler : public CPacketControlInterface::CUrgentPacketHandler {
+   public:
+      CEmergencyStopHandler(CDifferentialDriveSystem& c_differential_drive_system) :
+         m_cDifferentialDriveSystem(c_differential_drive_system) {}
+
+      bool HandleUrgentPacket(const CPacketControlInterface::CPacket& c_packet);
+
+   private:
+      CDifferentialDriveSystem& m_cDifferentialDriveSystem;
+   };
+
    /* private constructor */
    CFirmware() :
+      m_cTimer(TCCR2A,
+               TCCR2A | (1 << WGM21) | (1 << WGM20),
+               TCCR2B,
+               TCCR2B | (1 << CS22),
+               TIMSK2,
+               TIMSK2 | (1 << TOIE2),
+               TIFR2,
+               TCNT2,
+               TIMER2_OVF_vect_num),
       m_cHUARTController(CHUARTController::instance()),
       m_cTWController(CTWController::GetInstance()),
-      m_cPacketControlInterface(m_cHUARTController) {     
+      m_cPacketControlInterface(m_cHUARTController),
+      m_cEmergencyStopHandler(m_cDifferentialDriveSystem) {
+
+      m_cPacketControlInterface.SetUrgentPacketHandler(&m_cEmergencyStopHandler);
+
+      /* Clock of the timestamps sent with LINK_OPTION_TIMESTAMP */
+      m_cPacketControlInterface.SetClock([] {
+         return CFirmware::GetInstance().GetTimer().GetMicroseconds();
+      });
 
       /* Enable interrupts */
       sei();
    }
 
+   /* Timer 2 is used for the system time, timer 0 and timer 1 are used by the
+      differential drive system */
+   CTimer m_cTimer;
+
    /* ATMega328P Controllers */
    CHUARTController& m_cHUARTController;
    CTWController& m_cTWController;
@@ -61,11 +117,10 @@ private:
    CDifferentialDriveSystem m_cDifferentialDriveSystem;
    CAccelerometerSystem m_cAccelerometerSystem;
 
+   CEmergencyStopHandler m_cEmergencyStopHandler;
+
    static CFirmware _firmware;
 
-public: // TODO, don't make these public
-    /* File structs for fprintf */
-   FILE* m_psHUART;
 };
 
 #endif
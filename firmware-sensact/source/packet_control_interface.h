@@ -2,6 +2,8 @@
 #define PACKET_CONTROL_INTERFACE_H
 
 #include <huart_controller.h>
+#include <log.h>
+#include <pending_work.h>
 
 #define RX_COMMAND_BUFFER_LENGTH 32
 #define TX_COMMAND_BUFFER_LENGTH 32
@@ -23,7 +25,178 @@
 #define TYPE_OFFSET 2
 #define DATA_LENGTH_OFFSET 3
 #define DATA_START_OFFSET 4
-#define CHECKSUM_OFFSET -3
+
+/* Link options, enabled with the SET_LINK_OPTIONS packet */
+#define LINK_OPTION_CRC 0x01
+#define LINK_OPTION_COBS 0x02
+#define LINK_OPTION_TAG 0x04
+#define LINK_OPTION_EVENT_ACK 0x08
+#define LINK_OPTION_TIMESTAMP 0x10
+
+#define SUPPORTED_LINK_OPTIONS (LINK_OPTION_CRC | LINK_OPTION_COBS | LINK_OPTION_TAG | \
+                                LINK_OPTION_EVENT_ACK | LINK_OPTION_TIMESTAMP)
+
+/* With LINK_OPTION_CRC, a sequence number follows the preamble and the checksum is
+   replaced by a CRC-16 (CCITT, initial value 0xFFFF, MSB first) over the sequence
+   number, type, length and data fields. The other offsets move by one byte */
+#define SEQUENCE_OFFSET 2
+#define SEQUENCE_FIELD_SIZE 1
+#define CRC_FIELD_SIZE 2
+#define CRC_INITIAL_VALUE 0xFFFF
+
+#define CRC_MODE_EXTRA_SIZE (SEQUENCE_FIELD_SIZE + CRC_FIELD_SIZE - CHECKSUM_FIELD_SIZE)
+
+/* With LINK_OPTION_TAG, a tag byte chosen by the host follows the preamble and the
+   sequence number, and is covered by the checksum or CRC. The firmware copies the tag
+   of a request into the frames of its replies, so that the host can match replies to
+   requests that are in flight at the same time. Other frames carry a zero tag */
+#define TAG_FIELD_SIZE 1
+
+/* With LINK_OPTION_TIMESTAMP, the frames sent by the firmware carry the time of the
+   firmware clock in microseconds (MSB first) after the tag, covered by the checksum
+   or CRC. The frames sent by the host do not. Together with the receive and transmit
+   times of PING_FLAG_TIMESTAMPS, which allow the host to estimate the offset of the
+   clock like NTP does, the readings of the boards can be put on a common time base.
+   The time wraps around every 2^32 microseconds */
+#define TIMESTAMP_FIELD_SIZE 4
+
+/* With LINK_OPTION_COBS, the preamble and postamble are replaced by consistent overhead
+   byte stuffing of the fields in between. The encoded frame contains no zero bytes
+   and is terminated by a zero delimiter, so that the receiver resynchronises on the
+   next delimiter. Frames are shorter than 254 bytes, so the overhead is one code byte */
+#define COBS_DELIMITER 0x00
+#define COBS_MAXIMUM_BLOCK_CODE 0xFF
+#define COBS_OVERHEAD_SIZE 2
+
+/* Time after a baud rate change in which a valid frame must be received, otherwise
+   the previous baud rate is restored */
+#ifndef BAUD_RATE_FALLBACK_TIMEOUT
+#define BAUD_RATE_FALLBACK_TIMEOUT 1000
+#endif
+
+/* With this flag in the first data byte of a PING packet, the receive and transmit
+   times of the firmware in microseconds (MSB first) are inserted after the flags. The
+   receive time is the arrival time of the frame, see CPacket::GetArrivalTime */
+#define PING_FLAG_TIMESTAMPS 0x01
+#define PING_TIMESTAMPS_SIZE 8
+
+/* Reply of GET_CAPABILITIES: [protocol version, board id, build hash (MSB first)],
+   followed by a bitmap of the supported types, see CCommandRegistry::GetTypeBitmap.
+   The protocol version is incremented when the frame format or a packet changes */
+#define PROTOCOL_VERSION 1
+#define CAPABILITIES_HEADER_SIZE 6
+
+#define BOARD_ID_SENSACT 0x01
+#define BOARD_ID_PM 0x02
+#define BOARD_ID_MANIP 0x03
+
+/* Abbreviated commit hash of the sources, set by the Makefile */
+#ifndef FIRMWARE_BUILD_HASH
+#define FIRMWARE_BUILD_HASH 0x00000000UL
+#endif
+
+/* Number of sequence numbers after the base of the receive window */
+#define RX_WINDOW_SIZE 8
+
+/* The frames received in CRC mode are acknowledged together by a LINK_ACK packet, once
+   this many are waiting or the first has waited for LINK_ACK_DELAY microseconds. A
+   retransmitted frame is acknowledged at once */
+#ifndef LINK_ACK_FRAME_COUNT
+#define LINK_ACK_FRAME_COUNT 4
+#endif
+
+#ifndef LINK_ACK_DELAY
+#define LINK_ACK_DELAY 10000
+#endif
+
+/* In CRC mode, the frames of the replies to the last REPLY_CACHE_SIZE requests are kept
+   as they were written into the transmit buffer, and sent again when the host
+   retransmits the request because the reply was lost. Replies longer than
+   REPLY_CACHE_LENGTH bytes, e.g. fragmented ones, are not kept */
+#ifndef REPLY_CACHE_SIZE
+#define REPLY_CACHE_SIZE 2
+#endif
+
+#ifndef REPLY_CACHE_LENGTH
+#define REPLY_CACHE_LENGTH TX_COMMAND_BUFFER_LENGTH
+#endif
+
+#define REPLY_NOT_CACHED 0xFF
+
+/* Received frames are queued without their preamble, checksum and postamble. One
+   slot of the queue is always reserved for the frame that is being received */
+#ifndef RX_FRAME_QUEUE_DEPTH
+#define RX_FRAME_QUEUE_DEPTH 4
+#endif
+
+/* With hardware flow control, see HUART_RTS_PORT, the host is stopped once this many
+   frames are queued and resumed once the queue is down to RX_FLOW_CONTROL_RESUME_LEVEL.
+   The free slots above the stop level take the frame the host is sending when it stops */
+#ifndef RX_FLOW_CONTROL_STOP_LEVEL
+#define RX_FLOW_CONTROL_STOP_LEVEL (RX_FRAME_QUEUE_DEPTH - 2)
+#endif
+
+#ifndef RX_FLOW_CONTROL_RESUME_LEVEL
+#define RX_FLOW_CONTROL_RESUME_LEVEL (RX_FLOW_CONTROL_STOP_LEVEL / 2)
+#endif
+
+#define RX_FRAME_LENGTH (RX_COMMAND_BUFFER_LENGTH - PREAMBLE_SIZE - \
+                         CHECKSUM_FIELD_SIZE - POSTAMBLE_SIZE)
+
+/* Packets that do not fit into a frame are sent as a sequence of FRAGMENT packets.
+   Received fragments are reassembled into a buffer of this length. In CRC mode, a
+   fragment is only accepted if it is the next expected frame */
+#ifndef FRAGMENT_BUFFER_LENGTH
+#define FRAGMENT_BUFFER_LENGTH 64
+#endif
+
+#define FRAGMENT_INDEX_MASK 0x7F
+#define FRAGMENT_LAST 0x80
+
+/* A reply that does not fit into the transmit buffer of the UART is held and its
+   frames are written by ProcessInput as the buffer drains. Up to HELD_REPLY_LENGTH
+   bytes of its data can be held, a longer reply is only sent if the rest fits */
+#ifndef HELD_REPLY_LENGTH
+#define HELD_REPLY_LENGTH FRAGMENT_BUFFER_LENGTH
+#endif
+
+/* Maximum number of packet types that can be subscribed to at the same time */
+#ifndef SUBSCRIPTION_TABLE_SIZE
+#define SUBSCRIPTION_TABLE_SIZE 4
+#endif
+
+/* Maximum number of commands waiting for their scheduled time and the longest data
+   of a scheduled command */
+#ifndef SCHEDULE_QUEUE_SIZE
+#define SCHEDULE_QUEUE_SIZE 4
+#endif
+
+#ifndef SCHEDULED_DATA_LENGTH
+#define SCHEDULED_DATA_LENGTH 4
+#endif
+
+#define SCHEDULE_TIME_FIELD_SIZE 4
+
+/* Events are unsolicited packets, e.g. a GET_LIMIT_SWITCH_STATE reply sent when a limit
+   switch changes. There is one entry per packet type, so that a new event replaces the
+   unsent event of the same type, and an event is not sent again within the minimum
+   interval. With LINK_OPTION_EVENT_ACK, events are sent as EVENT packets and repeated
+   until the host acknowledges them with ACK_EVENT */
+#ifndef EVENT_TABLE_SIZE
+#define EVENT_TABLE_SIZE 4
+#endif
+
+#ifndef EVENT_DATA_LENGTH
+#define EVENT_DATA_LENGTH 4
+#endif
+
+#ifndef EVENT_MINIMUM_INTERVAL
+#define EVENT_MINIMUM_INTERVAL 100
+#endif
+
+#ifndef EVENT_RETRANSMIT_PERIOD
+#define EVENT_RETRANSMIT_PERIOD 500
+#endif
 
 class CPacketControlInterface {
 
@@ -53,6 +226,7 @@ public:
          GET_DDS_SPEED  = 0x13,
          SET_DDS_PARAMS = 0x14,
          GET_DDS_PARAMS = 0x15,
+         GET_DDS_FAULT = 0x16,
          /* Accelerometer System Packets */
          GET_ACCEL_READING = 0x20,
 
@@ -66,6 +240,7 @@ public:
          SET_USBIF_ENABLE = 0x42,
          /* Other */
          REQ_SOFT_PWDN = 0x43,
+         /* With [acknowledged sequence number] as data, the reply is a delta, see CDeltaEncoder */
          GET_PM_STATUS = 0x44,
          GET_USB_STATUS = 0x45,
 
@@ -102,6 +277,39 @@ public:
          WRITE_SMBUS_WORD_DATA = 0xD2,
          WRITE_SMBUS_BLOCK_DATA = 0xD3,
          WRITE_SMBUS_I2C_BLOCK_DATA = 0xD4,
+
+         /*************************************/
+         /* Link and Protocol Control         */
+         /*************************************/
+         /* Sequence of [type, length, data] sub-packets */
+         BATCH = 0xE0,
+         /* Periodic replies: [type, period (ms, MSB first)], a zero period unsubscribes */
+         SET_SUBSCRIPTION = 0xE1,
+         /* Link options bitmask, the reply is sent before the options take effect */
+         SET_LINK_OPTIONS = 0xE2,
+         /* Receive window: [next expected sequence number, bitmask of the following 8] */
+         LINK_ACK = 0xE3,
+         /* Part of a longer packet: [index | FRAGMENT_LAST, data], the data of the
+            fragment with index zero starts with the type of the packet */
+         FRAGMENT = 0xE4,
+         /* Baud rate (MSB first), the reply [accepted] is sent at the previous baud rate */
+         SET_BAUD_RATE = 0xE5,
+         /* Link counters, see SendLinkStatistics. A non-zero data byte resets them */
+         GET_LINK_STATS = 0xE6,
+         /* Echo of [flags, payload], see PING_FLAG_TIMESTAMPS */
+         PING = 0xE7,
+         /* [time (us, MSB first), type, data] executes the packet at the time of the
+            firmware timer, the reply is [accepted] */
+         SCHEDULE_COMMAND = 0xE8,
+         /* Event with LINK_OPTION_EVENT_ACK: [type, sequence number, data] */
+         EVENT = 0xE9,
+         /* Acknowledgement of an event: [type, sequence number] */
+         ACK_EVENT = 0xEA,
+         /* Identity of the firmware and the types it handles, see CAPABILITIES_HEADER_SIZE.
+            LINK_ACK and FRAGMENT are handled by the link and not listed */
+         GET_CAPABILITIES = 0xEB,
+         /* Records of the log: [number of dropped records, records], see CLog */
+         LOG = 0xEC,
          /*************************************/
          /* Invalid value for conversions     */
          /*************************************/
@@ -112,10 +320,14 @@ public:
 
       CPacket(uint8_t un_type_id,
               uint8_t un_data_length,
-              uint8_t* pun_data) :
+              const uint8_t* pun_data,
+              uint32_t un_arrival_time = 0,
+              uint32_t un_dispatch_time = 0) :
          m_unTypeId(un_type_id),
          m_unDataLength(un_data_length),
-         m_punData(pun_data) {}
+         m_punData(pun_data),
+         m_unArrivalTime(un_arrival_time),
+         m_unDispatchTime(un_dispatch_time) {}
       
       EType GetType() const;
       
@@ -123,19 +335,96 @@ public:
       uint8_t GetDataLength() const;
       const uint8_t* GetDataPointer() const;
 
+      /* Times of the clock set by SetClock, in microseconds, or zero without a clock.
+         The arrival time is captured in the receive interrupt when the first byte of
+         the frame arrives, or of the first fragment, and the dispatch time when
+         ProcessInput hands the packet out, so that the difference is the time the
+         packet waited in the queue. A scheduled command arrives at its scheduled
+         time, and the request of a subscription when it is generated. The entries
+         of a batch have the times of the batch */
+      uint32_t GetArrivalTime() const;
+      uint32_t GetDispatchTime() const;
+
+      /* reads the sub-packet at un_offset of a batch into c_entry and advances
+         un_offset, returns false at the end of the batch or if it is malformed */
+      bool GetBatchEntry(uint8_t& un_offset, CPacket& c_entry) const;
+
    private: 
       uint8_t m_unTypeId;
       uint8_t m_unDataLength;
-      uint8_t* m_punData;
+      const uint8_t* m_punData;
+      uint32_t m_unArrivalTime;
+      uint32_t m_unDispatchTime;
    };
 
 public:
    CPacketControlInterface(CHUARTController& c_controller) :
-      m_eState(EState::SRCH_PREAMBLE1),
-      m_unRxBufferPointer(0),
-      m_unUsedBufferLength(0),
+      m_unRxQueueHead(0),
+      m_unRxQueueTail(0),
+      m_unRxOverflowCount(0),
+      m_unRxFrameCount(0),
+      m_unRxChecksumErrorCount(0),
+      m_unRxDiscardedCount(0),
+      m_pcUrgentPacketHandler(nullptr),
+      m_unStopCount(0),
+      m_unHandledStopCount(0),
+      m_bPacketHeld(false),
+      m_bPacketReassembled(false),
+      m_unFragmentType(0),
+      m_unFragmentIndex(0),
+      m_unFragmentLength(0),
+      m_unFragmentArrivalTime(0),
+      m_bBatchOpen(false),
+      m_unBatchLength(0),
+      m_psSubscriptions(),
+      m_unScheduledCommandCount(0),
+      m_psEvents(),
+      m_unEventTime(0),
+      m_fnGetMicroseconds(nullptr),
+      m_unLinkOptions(0),
+      m_unTxSequence(0),
+      m_unRxWindowBase(0),
+      m_unRxWindowMask(0),
+      m_unAckFrameCount(0),
+      m_bAckDeadlineSet(false),
+      m_unAckDeadline(0),
+      m_bResendPending(false),
+      m_unResendSequence(0),
+      m_psReplyCache(),
+      m_unReplyCacheNext(0),
+      m_psReplyCapture(nullptr),
+      m_unReplyTag(0),
+      m_bHoldReplies(false),
+      m_bReplyHeld(false),
+      m_sHeldReply(),
+      m_unFallbackBaudRate(0),
+      m_unBaudRateDeadline(0),
+      m_bFrameReceived(false),
       m_cPacket(0xFF, 0, 0),
-      m_cController(c_controller) {}
+      m_cController(c_controller),
+      m_cFrameReceiver(this) {
+      m_cController.SetReceiver(&m_cFrameReceiver);
+   }
+
+   /* Handler called from the receive interrupt for each valid frame, before it is
+      queued, so that packets such as emergency stops take effect without waiting for
+      ProcessInput. In CRC mode, retransmitted frames are not passed to the handler.
+      The handler checks the data length itself and returns true if it executed the
+      packet, which is then not queued, even if there is no space left in the queue.
+      An executed urgent packet stops the board, so the packets received before it
+      are discarded instead of being executed after it: the queued frames, the
+      packet being reassembled and the scheduled commands. In CRC mode, the frames
+      missing before it are taken as received, their retransmissions are only
+      acknowledged */
+   class CUrgentPacketHandler {
+   public:
+      virtual bool HandleUrgentPacket(const CPacket& c_packet) = 0;
+   };
+
+   void SetUrgentPacketHandler(CUrgentPacketHandler* pc_urgent_packet_handler);
+
+   /* Sets the clock of the timestamps, LINK_OPTION_TIMESTAMP is not supported without it */
+   void SetClock(uint32_t (*fn_get_microseconds)());
 
    EState GetState() const;
 
@@ -147,33 +436,345 @@ public:
 
    void Reset();
 
-   void SendPacket(CPacket::EType e_type,
+   /* number of valid frames dropped because the receive queue was full */
+   uint16_t GetOverflowCount() const;
+
+   /* Sends the GET_LINK_STATS reply with the counters of the UART and of the frame
+      receiver, each MSB first: received bytes, accepted frames, checksum or CRC
+      errors, discarded bytes, frame queue overflows, rx buffer overruns, data
+      overruns, frame errors and parity errors. The counters are reset if b_reset
+      is true and the reply was sent */
+   bool SendLinkStatistics(bool b_reset);
+
+   /* While a batch is open, the sent packets are collected as [type, length, data]
+      records and sent as a single BATCH packet by EndBatch. If the records do not
+      fit into one packet, the full BATCH packets are sent early */
+   void BeginBatch();
+
+   bool EndBatch();
+
+   /* Sets the LINK_OPTION_* flags and restarts the sequence numbers in both directions.
+      Unsupported options are ignored, the options in effect are returned */
+   uint8_t SetLinkOptions(uint8_t un_link_options);
+
+   uint8_t GetLinkOptions() const {
+      return m_unLinkOptions;
+   }
+
+   /* Switches the UART to un_baud_rate once the pending frames are sent. Unless a
+      valid frame is received within BAUD_RATE_FALLBACK_TIMEOUT of un_time_ms, the
+      previous baud rate is restored by CheckBaudRate */
+   void SetBaudRate(uint32_t un_baud_rate, uint32_t un_time_ms);
+
+   void CheckBaudRate(uint32_t un_time_ms);
+
+   /* Subscribes to the packet type un_type_id, so that a request without data for
+      that type is generated every un_period_ms milliseconds. A zero period removes
+      the subscription. Returns false if the subscription table is full */
+   bool SetSubscription(uint8_t un_type_id, uint16_t un_period_ms, uint32_t un_time_ms);
+
+   /* Returns true and a request in c_packet if a subscription is due at un_time_ms */
+   bool GetDueSubscription(uint32_t un_time_ms, CPacket& c_packet);
+
+   /* Queues the packet un_type_id to be executed at un_time_us, commands with the same
+      time are executed in the order they were scheduled. Times more than half the
+      range of the timer ahead are taken to be in the past. The queue is cleared when
+      an urgent packet is executed, see CUrgentPacketHandler. Returns false if the
+      queue is full or the data is longer than SCHEDULED_DATA_LENGTH */
+   bool ScheduleCommand(uint32_t un_time_us,
+                        uint8_t un_type_id,
+                        const uint8_t* pun_data,
+                        uint8_t un_data_length);
+
+   /* Returns true and the earliest scheduled command in c_packet if it is due at
+      un_time_us. The data of c_packet is valid until the next call */
+   bool GetDueCommand(uint32_t un_time_us, CPacket& c_packet);
+
+   /* The main loop does not sleep while commands are scheduled, see CPendingWork */
+   bool HasScheduledCommands() const {
+      return (m_unScheduledCommandCount != 0);
+   }
+
+   /* Posts an event of the packet type un_type_id, which is sent by SendEvents. Returns
+      false if the event table is full or the data is longer than EVENT_DATA_LENGTH */
+   bool PostEvent(uint8_t un_type_id,
+                  const uint8_t* pun_data = nullptr,
+                  uint8_t un_data_length = 0);
+
+   /* Sends the posted events and repeats the unacknowledged ones that are due */
+   void SendEvents(uint32_t un_time_ms);
+
+   /* Handles the ACK_EVENT packet of the host */
+   void AcknowledgeEvent(uint8_t un_type_id, uint8_t un_sequence);
+
+   /* Sends the records of c_log in a LOG packet if the link is idle, i.e. no received
+      frame is waiting, no reply is held and the transmit buffer of the UART is empty */
+   void SendLog(CLog& c_log);
+
+   /* Packets that are longer than the data of a frame are sent as fragments. The
+      frames are written into the transmit buffer of the UART without waiting. A
+      reply to a packet handed out by GetPacket, GetDueSubscription or GetDueCommand
+      that does not fit is held, see HELD_REPLY_LENGTH. Returns false if there is no
+      space for the packet, e.g. because another reply is held. The fragments of a
+      packet are then not sent at all, so that the host never receives an
+      incomplete packet */
+   bool SendPacket(CPacket::EType e_type,
                    const uint8_t* pun_tx_data,
                    uint8_t un_tx_data_length);
                    
-   void SendPacket(CPacket::EType e_type,
+   bool SendPacket(CPacket::EType e_type,
                    uint8_t un_tx_data) {
-      SendPacket(e_type, &un_tx_data, 1);                
+      return SendPacket(e_type, &un_tx_data, 1);
    }
    
-   void SendPacket(CPacket::EType e_type) {
-      SendPacket(e_type, nullptr, 0);                
+   bool SendPacket(CPacket::EType e_type) {
+      return SendPacket(e_type, nullptr, 0);
    }
 
 private:
-   uint8_t ComputeChecksum(uint8_t* pun_buf_data, uint8_t un_buf_length);
-   void AdjustBuffer();
-   void ReceiveFrame(uint8_t *pun_data, uint8_t un_length);
+   /* Largest data length that can be sent with the current link options */
+   uint8_t GetMaximumTxDataLength() const;
 
-   EState m_eState;
+   /* Number of bytes written into the transmit buffer for a frame with this data length */
+   uint8_t GetFrameLength(uint8_t un_data_length) const;
+
+   /* Stops or resumes the host depending on the number of queued frames */
+   void UpdateFlowControl();
+
+   /* Returns false if the sequence number was already received or is beyond the
+      receive window, otherwise UpdateRxWindow moves the window past it, and past the
+      missing frames before it if b_skip_missing is set. Both are called by the frame
+      receiver in the interrupt context */
+   bool IsInRxWindow(uint8_t un_sequence) const;
+   void UpdateRxWindow(uint8_t un_sequence, bool b_skip_missing = false);
+
+   /* Discards the scheduled commands and the packet being reassembled once an
+      urgent packet was executed */
+   void DiscardStaleCommands();
+
+   bool FlushBatch();
+
+   /* Waits for the held reply and the pending frames to be sent and changes the baud
+      rate of the UART */
+   void ChangeBaudRate(uint32_t un_baud_rate);
+
+   /* Writes the fields of a frame, COBS encoded and followed by the delimiter, into
+      the reserved space of the transmit buffer */
+   void WriteEncoded(const uint8_t* pun_fields, uint8_t un_fields_length);
+
+   /* Writes a byte into the reserved space of the transmit buffer and into the
+      reply cache entry that is collecting the reply */
+   void WriteReserved(uint8_t un_byte);
+
+   /* Starts collecting the reply to the frame with this sequence number */
+   void CaptureReply(uint8_t un_sequence);
+
+   /* Sends the cached reply to the frame with this sequence number again, if any.
+      Returns false if it does not fit into the transmit buffer */
+   bool ResendReply(uint8_t un_sequence);
+
+   /* Keeps the rest of a reply that does not fit, pun_header holds the index of the
+      next fragment and the packet type */
+   void HoldReply(bool b_fragmented,
+                  const uint8_t* pun_header,
+                  const uint8_t* pun_tx_data,
+                  uint8_t un_tx_data_length);
+
+   /* Writes as many frames of the held reply as fit, returns true once it is sent */
+   bool SendHeldReply();
+
+   /* Writes the fragments of a packet until one does not fit and returns the number
+      of data bytes written. pun_header is updated to the next fragment */
+   uint8_t WriteFragments(uint8_t* pun_header,
+                          const uint8_t* pun_tx_data,
+                          uint8_t un_tx_data_length);
+
+   /* Sends the LINK_ACK packet if it is due */
+   void SendLinkAck();
+
+   /* Writes a frame, whose data is the header followed by the tx data, into the
+      transmit buffer. Returns false without writing anything if it does not fit or
+      a reply is held, which is sent first */
+   bool WriteFrame(CPacket::EType e_type,
+                   const uint8_t* pun_header,
+                   uint8_t un_header_length,
+                   const uint8_t* pun_tx_data,
+                   uint8_t un_tx_data_length);
+
+   /* Adds a fragment to the reassembly buffer, returns true once the packet is complete */
+   bool Reassemble(const CPacket& c_fragment);
+
+   /* queue of received frames, written by the frame receiver in the interrupt context */
+   struct SFrame {
+      uint32_t ArrivalTime;
+      uint8_t Sequence;
+      uint8_t Tag;
+      /* m_unStopCount when the frame was queued */
+      uint8_t StopCount;
+      uint8_t Buffer[RX_FRAME_LENGTH];
+   } m_psRxQueue[RX_FRAME_QUEUE_DEPTH];
+   volatile uint8_t m_unRxQueueHead;
+   volatile uint8_t m_unRxQueueTail;
+   volatile uint16_t m_unRxOverflowCount;
+   /* frames committed to the queue or executed by the urgent packet handler, frames
+      rejected by their checksum or CRC and bytes that were not part of a valid frame */
+   volatile uint16_t m_unRxFrameCount;
+   volatile uint16_t m_unRxChecksumErrorCount;
+   volatile uint16_t m_unRxDiscardedCount;
+
+   /* called by the frame receiver in the interrupt context */
+   CUrgentPacketHandler* m_pcUrgentPacketHandler;
+   /* urgent packets executed by the handler, the frames queued before the last one
+      are stale, and the count up to which the stale commands were discarded */
+   volatile uint8_t m_unStopCount;
+   uint8_t m_unHandledStopCount;
+
+   /* true while the frame at the tail of the queue or the reassembled packet is
+      handed out by GetPacket */
+   bool m_bPacketHeld;
+   bool m_bPacketReassembled;
+
+   /* packet being reassembled from fragments, a zero index means no fragment was received */
+   uint8_t m_unFragmentType;
+   uint8_t m_unFragmentIndex;
+   uint8_t m_unFragmentLength;
+   uint32_t m_unFragmentArrivalTime;
+   uint8_t m_punFragmentBuffer[FRAGMENT_BUFFER_LENGTH];
+
+   /* records of the batch reply that is being collected */
+   bool m_bBatchOpen;
+   uint8_t m_unBatchLength;
+   uint8_t m_punBatchBuffer[TX_COMMAND_BUFFER_LENGTH - NON_DATA_SIZE];
+
+   /* table of subscriptions, entries with a zero period are free */
+   struct SSubscription {
+      uint8_t TypeId;
+      uint16_t Period;
+      uint32_t Deadline;
+   } m_psSubscriptions[SUBSCRIPTION_TABLE_SIZE];
+
+   /* scheduled commands sorted by their time, and the copy of the command that is
+      handed out by GetDueCommand */
+   struct SScheduledCommand {
+      uint32_t Time;
+      uint8_t TypeId;
+      uint8_t DataLength;
+      uint8_t Data[SCHEDULED_DATA_LENGTH];
+   } m_psScheduledCommands[SCHEDULE_QUEUE_SIZE], m_sDueCommand;
+   uint8_t m_unScheduledCommandCount;
+
+   /* table of events, an entry is used for the same packet type once it is taken */
+   struct SEvent {
+      bool Used;
+      uint8_t TypeId;
+      uint8_t Sequence;
+      uint8_t DataLength;
+      /* posted but not sent, sent but not acknowledged */
+      bool Pending;
+      bool Unacknowledged;
+      uint32_t LastSent;
+      uint8_t Data[EVENT_DATA_LENGTH];
+   } m_psEvents[EVENT_TABLE_SIZE];
+   /* time of the last call to SendEvents */
+   uint32_t m_unEventTime;
+
+   /* clock of the timestamps */
+   uint32_t (*m_fnGetMicroseconds)();
+
+   /* link options, also read by the frame receiver in the interrupt context */
+   volatile uint8_t m_unLinkOptions;
+   /* sequence number of the next sent frame */
+   uint8_t m_unTxSequence;
+   /* next expected sequence number and the frames received after it, updated by the
+      frame receiver in the interrupt context */
+   volatile uint8_t m_unRxWindowBase;
+   volatile uint8_t m_unRxWindowMask;
+   /* frames received since the last acknowledgement, and when it is due */
+   volatile uint8_t m_unAckFrameCount;
+   bool m_bAckDeadlineSet;
+   uint32_t m_unAckDeadline;
+   /* sequence number of the last retransmitted frame, whose reply is sent again */
+   volatile bool m_bResendPending;
+   volatile uint8_t m_unResendSequence;
+   /* replies to the last requests, the next entry to use and the entry that collects
+      the frames that are sent, nullptr if they are not replies */
+   struct SReply {
+      uint8_t Sequence;
+      uint8_t Length;
+      uint8_t Data[REPLY_CACHE_LENGTH];
+   } m_psReplyCache[REPLY_CACHE_SIZE];
+   uint8_t m_unReplyCacheNext;
+   SReply* m_psReplyCapture;
+   /* tag of the packet handed out by GetPacket, written into the sent frames */
+   uint8_t m_unReplyTag;
+   /* set while the frames that are sent are replies, which are held if they do not
+      fit into the transmit buffer */
+   bool m_bHoldReplies;
+   /* reply waiting for space in the transmit buffer, sent before any other frame */
+   bool m_bReplyHeld;
+   struct SHeldReply {
+      uint8_t Tag;
+      SReply* Capture;
+      bool Fragmented;
+      uint8_t Header[2];
+      uint8_t Length;
+      uint8_t Data[HELD_REPLY_LENGTH];
+   } m_sHeldReply;
+
+   /* baud rate to restore if the last change is not confirmed by the deadline,
+      zero if there is no unconfirmed change */
+   uint32_t m_unFallbackBaudRate;
+   uint32_t m_unBaudRateDeadline;
+   /* set by the frame receiver whenever a valid frame is received */
+   volatile bool m_bFrameReceived;
 
-   uint8_t m_unRxBufferPointer;
-   uint8_t m_unUsedBufferLength;
-   uint8_t m_punRxBuffer[RX_COMMAND_BUFFER_LENGTH];
-   
    CPacket m_cPacket;
 
    CHUARTController& m_cController;
+
+   /* Frames the bytes from the USART receive interrupt directly into the queue */
+   class CFrameReceiver : public CHUARTController::CReceiver {
+   public:
+      CFrameReceiver(CPacketControlInterface* pc_packet_control_interface) :
+         m_pcPacketControlInterface(pc_packet_control_interface),
+         m_eState(EState::SRCH_PREAMBLE1),
+         m_unRxIndex(0),
+         m_unFrameBytes(0),
+         m_unChecksum(0),
+         m_unCRC(0),
+         m_unCobsCode(0),
+         m_bCobsZero(false) {}
+
+      EState GetState() const {
+         return m_eState;
+      }
+
+      void Reset();
+
+   private:
+      void Receive(uint8_t un_rx_byte);
+      /* steps the state machine with a received byte, or a decoded byte in COBS mode */
+      void Step(uint8_t un_rx_byte);
+      void Decode(uint8_t un_rx_byte);
+      void Resynchronise(uint8_t un_rx_byte);
+      void Accumulate(uint8_t un_rx_byte, bool b_use_crc);
+      /* stores the time of the clock in the slot at the head of the queue */
+      void CaptureArrivalTime();
+
+      CPacketControlInterface* m_pcPacketControlInterface;
+      volatile EState m_eState;
+      /* offset of the next byte in the frame and the running checksum or CRC */
+      uint8_t m_unRxIndex;
+      /* number of bytes received since the beginning of the frame, before decoding */
+      uint8_t m_unFrameBytes;
+      uint8_t m_unChecksum;
+      uint16_t m_unCRC;
+      /* bytes left in the current COBS block and whether a zero byte follows it */
+      uint8_t m_unCobsCode;
+      bool m_bCobsZero;
+   } m_cFrameReceiver;
+
+   friend CFrameReceiver;
 };
    
 #endif
@@ -29,6 +29,8 @@
 #include "tw_controller.h"
 #include "firmware.h"
 
+#include <pending_work.h>
+
 // Preinstantiate Objects //////////////////////////////////////////////////////
 
 CTWController CTWController::m_cTWController;
@@ -54,6 +56,8 @@ static volatile bool    bSendStop;			// should the transaction end with a stop
 static volatile bool    bInRepStart;			// in the middle of a repeated start
 
 static uint8_t          punMasterBuffer[TW_BUFFER_LENGTH];
+// punMasterBuffer, or the buffer of the queued transaction in progress
+static uint8_t*         punTransferBuffer = punMasterBuffer;
 static volatile uint8_t unMasterBufferIndex;
 static volatile uint8_t unMasterBufferLength;
 
@@ -66,6 +70,83 @@ static volatile uint8_t unRxBufferIndex;
 
 static volatile uint8_t unError;
 
+// queued transactions, the one at the head is in progress while unState is TW_STATE_QUEUE
+static CTWController::STransaction* volatile psTransactionHead = nullptr;
+static CTWController::STransaction* volatile psTransactionTail = nullptr;
+
+// Transaction Queue ////////////////////////////////////////////////////////////////
+
+// starts the transaction at the head of the queue, called with interrupts disabled
+static void StartTransaction()
+{
+   CTWController::STransaction& sTransaction = *psTransactionHead;
+   unState = TW_STATE_QUEUE;
+   punTransferBuffer = sTransaction.Buffer;
+   unMasterBufferIndex = 0;
+   if(sTransaction.WriteLength != 0 || sTransaction.ReadLength == 0) {
+      unSlarw = TW_WRITE | (sTransaction.Address << 1);
+      unMasterBufferLength = sTransaction.WriteLength;
+   }
+   else {
+      // as in Read, the last byte is received with a nack
+      unSlarw = TW_READ | (sTransaction.Address << 1);
+      unMasterBufferLength = sTransaction.ReadLength - 1;
+   }
+   TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTA);
+}
+
+/****************************************/
+/****************************************/
+
+// sends a stop and waits until it is done
+static void SendStop()
+{
+   TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTO); // stop
+   while(TWCR & _BV(TWSTO)){
+      continue;
+   }
+}
+
+/****************************************/
+/****************************************/
+
+// called from the interrupt once the bus is released at the end of a transfer,
+// completes the queued transaction in progress and starts the next one
+static void Finish(uint8_t un_result)
+{
+   if(unState == TW_STATE_QUEUE) {
+      CTWController::STransaction* psTransaction = psTransactionHead;
+      psTransactionHead = psTransaction->Next;
+      psTransaction->Result = un_result;
+      if(psTransaction->Handler != nullptr) {
+         psTransaction->Handler->HandleTransaction(*psTransaction);
+      }
+      CPendingWork::GetInstance().Set(PENDING_WORK_TW);
+   }
+   unState = TW_STATE_READY;
+   if(psTransactionHead != nullptr) {
+      StartTransaction();
+   }
+}
+
+/****************************************/
+/****************************************/
+
+// waits until the bus is free and claims it for a blocking transfer
+static void Claim(uint8_t un_state)
+{
+   for(;;) {
+      uint8_t unSREG = SREG;
+      cli();
+      if(unState == TW_STATE_READY) {
+         unState = un_state;
+         SREG = unSREG;
+         return;
+      }
+      SREG = unSREG;
+   }
+}
+
 // Interrupt Routine ////////////////////////////////////////////////////////////////
 
 ISR(TWI_vect)
@@ -84,16 +165,30 @@ ISR(TWI_vect)
       // if there is data to send, send it, otherwise stop 
       if(unMasterBufferIndex < unMasterBufferLength) {
          // copy data to output register and ack
-         TWDR = punMasterBuffer[unMasterBufferIndex++];
+         TWDR = punTransferBuffer[unMasterBufferIndex++];
          TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWEA); // reply with ack
       } 
+      else if(unState == TW_STATE_QUEUE) {
+         CTWController::STransaction& sTransaction = *psTransactionHead;
+         if(sTransaction.ReadLength == 0) {
+            SendStop();
+            Finish(TW_RESULT_SUCCESS);
+         }
+         else {
+            // continue with the read, the last byte is received with a nack
+            unSlarw = TW_READ | (sTransaction.Address << 1);
+            unMasterBufferIndex = 0;
+            unMasterBufferLength = sTransaction.ReadLength - 1;
+            if(!sTransaction.RepeatedStart) {
+               SendStop();
+            }
+            TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTA);
+         }
+      }
       else {
          if (bSendStop) {
-            TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTO); // stop
-            while(TWCR & _BV(TWSTO)){
-               continue;
-            }
-            unState = TW_STATE_READY;
+            SendStop();
+            Finish(TW_RESULT_SUCCESS);
          }
          else {
             bInRepStart = true;	// we're gonna send the START
@@ -107,30 +202,24 @@ ISR(TWI_vect)
       break;
    case TW_MT_SLA_NACK:  // address sent, nack received
       unError = TW_MT_SLA_NACK;
-      TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTO); // stop
-      while(TWCR & _BV(TWSTO)){
-         continue;
-      }
-      unState = TW_STATE_READY;
+      SendStop();
+      Finish(TW_RESULT_ADDRESS_NACK);
       break;
    case TW_MT_DATA_NACK: // data sent, nack received
       unError = TW_MT_DATA_NACK;
-      TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTO); // stop
-      while(TWCR & _BV(TWSTO)){
-         continue;
-      }
-      unState = TW_STATE_READY;
+      SendStop();
+      Finish(TW_RESULT_DATA_NACK);
       break;
    case TW_MT_ARB_LOST: // lost bus arbitration
       unError = TW_MT_ARB_LOST;
       TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT); // release bus
-      unState = TW_STATE_READY;
+      Finish(TW_RESULT_ERROR);
       break;
 
       // Master Receiver
    case TW_MR_DATA_ACK: // data received, ack sent
       // put byte into buffer
-      punMasterBuffer[unMasterBufferIndex++] = TWDR;
+      punTransferBuffer[unMasterBufferIndex++] = TWDR;
    case TW_MR_SLA_ACK:  // address sent, ack received
       // ack if more bytes are expected, otherwise nack
       if(unMasterBufferIndex < unMasterBufferLength){
@@ -142,13 +231,10 @@ ISR(TWI_vect)
       break;
    case TW_MR_DATA_NACK: // data received, nack sent
       // put final byte into buffer
-      punMasterBuffer[unMasterBufferIndex++] = TWDR;
-      if (bSendStop) {
-         TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTO); // stop
-         while(TWCR & _BV(TWSTO)){
-            continue;
-         }
-         unState = TW_STATE_READY;
+      punTransferBuffer[unMasterBufferIndex++] = TWDR;
+      if (bSendStop || unState == TW_STATE_QUEUE) {
+         SendStop();
+         Finish(TW_RESULT_SUCCESS);
       }
       else {
          bInRepStart = true;	// we're gonna send the START
@@ -160,11 +246,8 @@ ISR(TWI_vect)
       }    
       break;
    case TW_MR_SLA_NACK: // address sent, nack received
-      TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTO); // stop
-      while(TWCR & _BV(TWSTO)){
-         continue;
-      }
-      unState = TW_STATE_READY;
+      SendStop();
+      Finish(TW_RESULT_ADDRESS_NACK);
       break;
       // TW_MR_ARB_LOST handled by TW_MT_ARB_LOST case
 
@@ -173,11 +256,8 @@ ISR(TWI_vect)
       break;
    case TW_BUS_ERROR: // bus error, illegal stop/start
       unError = TW_BUS_ERROR;
-      TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTO); // stop
-      while(TWCR & _BV(TWSTO)){
-         continue;
-      }
-      unState = TW_STATE_READY;
+      SendStop();
+      Finish(TW_RESULT_ERROR);
       break;
    }
 }
@@ -230,16 +310,14 @@ uint8_t CTWController::Read(uint8_t un_address, uint8_t un_length, bool b_send_s
     return 0;
   }
 
-  // wait until I2C is ready, become master receiver
-  while(unState != TW_STATE_READY) {
-     continue; // os sleep
-  }
-  unState = TW_STATE_MRX;
+  // wait until I2C is ready and the queue is empty, become master receiver
+  Claim(TW_STATE_MRX);
   bSendStop = b_send_stop;
 
   // reset error state
   unError = TW_BUS_NO_ERROR;
 
+  punTransferBuffer = punMasterBuffer;
   unMasterBufferIndex = 0;
   unMasterBufferLength = un_length - 1;
   unSlarw = TW_READ;
@@ -282,6 +360,26 @@ uint8_t CTWController::Read(uint8_t un_address, uint8_t un_length, bool b_send_s
 }
 
 
+void CTWController::Submit(STransaction& s_transaction) {
+   s_transaction.Result = TW_RESULT_PENDING;
+   s_transaction.Next = nullptr;
+   uint8_t unSREG = SREG;
+   cli();
+   if(psTransactionHead == nullptr) {
+      psTransactionHead = &s_transaction;
+   }
+   else {
+      psTransactionTail->Next = &s_transaction;
+   }
+   psTransactionTail = &s_transaction;
+   // start at once unless a transfer is in progress or holds the bus for a repeated start
+   if(unState == TW_STATE_READY && !bInRepStart) {
+      StartTransaction();
+   }
+   SREG = unSREG;
+}
+
+
 void CTWController::BeginTransmission(uint8_t un_tx_address) {
   // indicate that we are transmitting
   m_bTransmitting = true;
@@ -315,18 +413,15 @@ uint8_t CTWController::EndTransmission(bool b_send_stop) {
       return 1;
    }
 
-   // wait until twi is ready, become master transmitter
-   while(unState != TW_STATE_READY) {
-      continue; // os sleep
-   }
-
-   unState = TW_STATE_MTX;
+   // wait until twi is ready and the queue is empty, become master transmitter
+   Claim(TW_STATE_MTX);
    bSendStop = b_send_stop;
 
    // reset error state (0xFF.. no error occured)
    unError = TW_BUS_NO_ERROR;
 
    // initialize buffer iteration vars
+   punTransferBuffer = punMasterBuffer;
    unMasterBufferIndex = 0;
    unMasterBufferLength = m_unTxBufferLength;
   
@@ -371,13 +466,13 @@ uint8_t CTWController::EndTransmission(bool b_send_stop) {
    m_bTransmitting = false;
   
    if (unError == TW_BUS_NO_ERROR) // clean up with case statement
-      return 0;	// success
+      return TW_RESULT_SUCCESS;
    else if (unError == TW_MT_SLA_NACK)
-      return 2;	// error: address send, nack received
+      return TW_RESULT_ADDRESS_NACK;	// error: address send, nack received
    else if (unError == TW_MT_DATA_NACK)
-      return 3;	// error: data send, nack received
+      return TW_RESULT_DATA_NACK;	// error: data send, nack received
   
-   return 4;	// other twi error
+   return TW_RESULT_ERROR;	// other twi error
 }
    
    
@@ -0,0 +1,560 @@
+
+#include <serial_transport.h>
+#include <simulated_board.h>
+#include <link_client.h>
+#include <log_decoder.h>
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/* replies that do not arrive within this time are counted as lost */
+#define PING_TIMEOUT 1000000
+#define REQUEST_TIMEOUT 1000000
+
+/* latency of the serial adapter and the operating system in both directions, added
+   to the retransmit timeout of the client */
+#define HOST_LATENCY 20000
+
+/* the payload of a ping starts with its 16-bit identifier */
+#define PING_ID_SIZE 2
+
+/* execution time of a packet on the simulated board during the stop check, long
+   enough for the motion commands to queue up behind each other */
+#define STOP_CHECK_PACKET_TIME 20000
+/* delay of the scheduled motion command of the stop check */
+#define STOP_CHECK_SCHEDULE_DELAY 500000
+
+/***********************************************************/
+/***********************************************************/
+
+struct SConfiguration {
+   const char* Port = nullptr;
+   bool Simulate = false;
+   uint32_t BaudRate = DEFAULT_BAUD_RATE;
+   uint8_t LinkOptions = 0;
+   std::vector<unsigned> Sizes = {2, 8, 16, 24, 32, 40};
+   std::vector<unsigned> Depths = {1, 2, 4};
+   unsigned Count = 200;
+   bool Timestamps = false;
+   bool Sync = false;
+   bool Log = false;
+   bool FlowControl = false;
+   bool StopCheck = false;
+};
+
+struct SResult {
+   unsigned Sent = 0;
+   unsigned Lost = 0;
+   std::vector<uint32_t> RoundTripTimes;
+   std::vector<uint32_t> BoardTimes;
+   uint64_t PayloadBytes = 0;
+   uint64_t Duration = 0;
+};
+
+/***********************************************************/
+/***********************************************************/
+
+static void PrintUsage(const char* pch_program) {
+   fprintf(stderr,
+           "usage: %s (--port <device> | --simulate) [options]\n"
+           "  --baud <rate>           baud rate of the link (default %u)\n"
+           "  --options <list>        link options: crc,cobs,tag,event-ack,timestamp (default none)\n"
+           "  --sizes <list>          ping payload sizes in bytes (default 2,8,16,24,32,40)\n"
+           "  --depths <list>         pings in flight at the same time (default 1,2,4)\n"
+           "  --count <n>             pings per size and depth (default 200)\n"
+           "  --timestamps            request the receive and transmit times of the board\n"
+           "  --sync                  estimate the offset of the clock of the board first\n"
+           "  --log                   print the log of the board instead of running the benchmark\n"
+           "  --rtscts                hardware flow control, see HUART_RTS_PORT in the firmware\n"
+           "  --stop                  check that a stop discards the queued and scheduled motion\n"
+           "                          commands instead of running the benchmark (the robot moves)\n",
+           pch_program, DEFAULT_BAUD_RATE);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+static bool ParseList(const char* pch_list, std::vector<unsigned>& vec_values) {
+   vec_values.clear();
+   char* pchEnd;
+   do {
+      unsigned long unValue = strtoul(pch_list, &pchEnd, 10);
+      if(pchEnd == pch_list || (*pchEnd != ',' && *pchEnd != '\0') || unValue == 0) {
+         return false;
+      }
+      vec_values.push_back(unValue);
+      pch_list = pchEnd + 1;
+   } while(*pchEnd == ',');
+   return true;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+static bool ParseLinkOptions(const char* pch_list, uint8_t& un_link_options) {
+   un_link_options = 0;
+   std::string strList(pch_list);
+   size_t unStart = 0;
+   while(unStart <= strList.size()) {
+      size_t unEnd = strList.find(',', unStart);
+      if(unEnd == std::string::npos) {
+         unEnd = strList.size();
+      }
+      std::string strOption = strList.substr(unStart, unEnd - unStart);
+      if(strOption == "crc") {
+         un_link_options |= LINK_OPTION_CRC;
+      }
+      else if(strOption == "cobs") {
+         un_link_options |= LINK_OPTION_COBS;
+      }
+      else if(strOption == "tag") {
+         un_link_options |= LINK_OPTION_TAG;
+      }
+      else if(strOption == "event-ack") {
+         un_link_options |= LINK_OPTION_EVENT_ACK;
+      }
+      else if(strOption == "timestamp") {
+         un_link_options |= LINK_OPTION_TIMESTAMP;
+      }
+      else if(strOption != "none") {
+         return false;
+      }
+      unStart = unEnd + 1;
+   }
+   return true;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+static bool ParseArguments(int n_argc, char** ppch_argv, SConfiguration& s_configuration) {
+   for(int nIdx = 1; nIdx < n_argc; nIdx++) {
+      std::string strArgument(ppch_argv[nIdx]);
+      bool bHasValue = (nIdx + 1 < n_argc);
+      if(strArgument == "--simulate") {
+         s_configuration.Simulate = true;
+      }
+      else if(strArgument == "--timestamps") {
+         s_configuration.Timestamps = true;
+      }
+      else if(strArgument == "--sync") {
+         s_configuration.Sync = true;
+      }
+      else if(strArgument == "--log") {
+         s_configuration.Log = true;
+      }
+      else if(strArgument == "--rtscts") {
+         s_configuration.FlowControl = true;
+      }
+      else if(strArgument == "--stop") {
+         s_configuration.StopCheck = true;
+      }
+      else if(!bHasValue) {
+         return false;
+      }
+      else if(strArgument == "--port") {
+         s_configuration.Port = ppch_argv[++nIdx];
+      }
+      else if(strArgument == "--baud") {
+         s_configuration.BaudRate = strtoul(ppch_argv[++nIdx], nullptr, 10);
+      }
+      else if(strArgument == "--options") {
+         if(!ParseLinkOptions(ppch_argv[++nIdx], s_configuration.LinkOptions)) {
+            return false;
+         }
+      }
+      else if(strArgument == "--sizes") {
+         if(!ParseList(ppch_argv[++nIdx], s_configuration.Sizes)) {
+            return false;
+         }
+      }
+      else if(strArgument == "--depths") {
+         if(!ParseList(ppch_argv[++nIdx], s_configuration.Depths)) {
+            return false;
+         }
+      }
+      else if(strArgument == "--count") {
+         s_configuration.Count = strtoul(ppch_argv[++nIdx], nullptr, 10);
+      }
+      else {
+         return false;
+      }
+   }
+   return (s_configuration.Simulate != (s_configuration.Port != nullptr)) &&
+      s_configuration.BaudRate != 0 && s_configuration.Count != 0;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+/* Switches the board and the client to un_link_options, the reply is framed with
+   the previous options. Returns false if the board does not support the options */
+static bool NegotiateLinkOptions(CLinkClient& c_client, uint8_t un_link_options) {
+   CLinkClient::SPacket sReply;
+   if(!c_client.Request(static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::SET_LINK_OPTIONS),
+                        std::vector<uint8_t>(1, un_link_options),
+                        sReply,
+                        REQUEST_TIMEOUT) || sReply.Data.size() != 1) {
+      return false;
+   }
+   c_client.SetLinkOptions(sReply.Data[0]);
+   return (sReply.Data[0] == un_link_options);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+static uint32_t GetPercentile(std::vector<uint32_t> vec_values, unsigned un_percentile) {
+   if(vec_values.empty()) {
+      return 0;
+   }
+   std::sort(vec_values.begin(), vec_values.end());
+   return vec_values[(vec_values.size() - 1) * un_percentile / 100];
+}
+
+/***********************************************************/
+/***********************************************************/
+
+/* NTP-style estimate of the offset of the board clock: t1 and t4 are the host times
+   of the request and the reply, t2 and t3 the receive and transmit times of the board.
+   The exchange with the shortest round trip bounds the offset most tightly */
+static void RunClockSync(CTransport& c_transport,
+                         CLinkClient& c_client,
+                         unsigned un_count) {
+   uint32_t unBestOffset = 0;
+   uint32_t unBestDelay = UINT32_MAX;
+   std::vector<uint32_t> vecDelays;
+   std::vector<uint32_t> vecFrameDelays;
+   for(unsigned unExchange = 0; unExchange < un_count; unExchange++) {
+      CLinkClient::SPacket sReply;
+      uint32_t unT1 = c_transport.GetMicroseconds();
+      if(!c_client.Request(static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::PING),
+                           std::vector<uint8_t>(1, PING_FLAG_TIMESTAMPS),
+                           sReply,
+                           PING_TIMEOUT) ||
+         sReply.Data.size() != 1 + PING_TIMESTAMPS_SIZE) {
+         continue;
+      }
+      uint32_t unT4 = c_transport.GetMicroseconds();
+      uint32_t punTimes[2] = {0, 0};
+      for(size_t unIdx = 0; unIdx < PING_TIMESTAMPS_SIZE; unIdx++) {
+         punTimes[unIdx / 4] = (punTimes[unIdx / 4] << 8) | sReply.Data[1 + unIdx];
+      }
+      uint32_t unT2 = punTimes[0];
+      uint32_t unT3 = punTimes[1];
+      /* the round trip time without the time spent on the board */
+      uint32_t unDelay = (unT4 - unT1) - (unT3 - unT2);
+      /* board time minus host time, modulo 2^32 like the clock of the board */
+      uint32_t unOffset = (unT2 - unT1) + static_cast<int32_t>((unT3 - unT4) - (unT2 - unT1)) / 2;
+      vecDelays.push_back(unDelay);
+      if(unDelay < unBestDelay) {
+         unBestDelay = unDelay;
+         unBestOffset = unOffset;
+      }
+      if(c_client.GetLinkOptions() & LINK_OPTION_TIMESTAMP) {
+         vecFrameDelays.push_back(sReply.Timestamp - unT3);
+      }
+   }
+   if(vecDelays.empty()) {
+      printf("clock: no replies\n");
+      return;
+   }
+   printf("clock: offset %dus +-%uus, delay min %uus p50 %uus over %zu exchanges\n",
+          static_cast<int32_t>(unBestOffset), unBestDelay / 2, unBestDelay, GetPercentile(vecDelays, 50), vecDelays.size());
+   if(!vecFrameDelays.empty()) {
+      printf("clock: frame timestamps %uus after the transmit time (p50)\n",
+             GetPercentile(vecFrameDelays, 50));
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+static SResult RunPings(CTransport& c_transport,
+                        CLinkClient& c_client,
+                        const SConfiguration& s_configuration,
+                        unsigned un_size,
+                        unsigned un_depth) {
+   struct SPing {
+      uint16_t Id;
+      uint64_t SendTime;
+   };
+   SResult sResult;
+   std::deque<SPing> cInFlight;
+   uint16_t unNextId = 0;
+   bool bUseTags = (c_client.GetLinkOptions() & LINK_OPTION_TAG);
+   size_t unIdOffset = 1 + (s_configuration.Timestamps ? PING_TIMESTAMPS_SIZE : 0);
+   uint64_t unStartTime = c_transport.GetMicroseconds();
+
+   while(sResult.Sent < s_configuration.Count || !cInFlight.empty()) {
+      /* keep un_depth pings in flight */
+      while(sResult.Sent < s_configuration.Count && cInFlight.size() < un_depth) {
+         std::vector<uint8_t> vecData(1 + un_size);
+         vecData[0] = s_configuration.Timestamps ? PING_FLAG_TIMESTAMPS : 0;
+         vecData[1] = (unNextId >> 8) & 0xFF;
+         vecData[2] = (unNextId >> 0) & 0xFF;
+         for(size_t unIdx = 1 + PING_ID_SIZE; unIdx < vecData.size(); unIdx++) {
+            vecData[unIdx] = unIdx;
+         }
+         cInFlight.push_back(SPing {unNextId, c_transport.GetMicroseconds()});
+         /* tags are never zero, which marks the frames that are not replies */
+         c_client.SendPacket(static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::PING),
+                             vecData,
+                             bUseTags ? (unNextId % 255) + 1 : 0);
+         unNextId++;
+         sResult.Sent++;
+      }
+      uint64_t unTime = c_transport.GetMicroseconds();
+      uint64_t unDeadline = cInFlight.front().SendTime + PING_TIMEOUT;
+      CLinkClient::SPacket sReply;
+      if(unTime >= unDeadline ||
+         !c_client.ReceivePacket(sReply, unDeadline - unTime)) {
+         cInFlight.pop_front();
+         sResult.Lost++;
+         continue;
+      }
+      unTime = c_transport.GetMicroseconds();
+      if(sReply.Type != static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::PING) ||
+         sReply.Data.size() != unIdOffset + un_size) {
+         continue;
+      }
+      uint16_t unId = (sReply.Data[unIdOffset] << 8) | sReply.Data[unIdOffset + 1];
+      if(bUseTags && sReply.Tag != (unId % 255) + 1) {
+         continue;
+      }
+      /* the replies arrive in order, the pings before the matched one were lost */
+      std::deque<SPing>::iterator itPing = cInFlight.begin();
+      while(itPing != cInFlight.end() && itPing->Id != unId) {
+         ++itPing;
+      }
+      if(itPing == cInFlight.end()) {
+         continue;
+      }
+      sResult.Lost += itPing - cInFlight.begin();
+      sResult.RoundTripTimes.push_back(unTime - itPing->SendTime);
+      sResult.PayloadBytes += un_size;
+      if(s_configuration.Timestamps) {
+         uint32_t punTimes[2] = {0, 0};
+         for(size_t unIdx = 0; unIdx < PING_TIMESTAMPS_SIZE; unIdx++) {
+            punTimes[unIdx / 4] = (punTimes[unIdx / 4] << 8) | sReply.Data[1 + unIdx];
+         }
+         sResult.BoardTimes.push_back(punTimes[1] - punTimes[0]);
+      }
+      cInFlight.erase(cInFlight.begin(), itPing + 1);
+   }
+   sResult.Duration = c_transport.GetMicroseconds() - unStartTime;
+   return sResult;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+/* Prints the records of the LOG packets of the board until the program is stopped */
+static void RunLogMonitor(CLinkClient& c_client) {
+   for(;;) {
+      CLinkClient::SPacket sPacket;
+      if(!c_client.ReceivePacket(sPacket, REQUEST_TIMEOUT) ||
+         sPacket.Type != static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::LOG)) {
+         continue;
+      }
+      std::vector<std::string> vecLines;
+      bool bValid = CLogDecoder::Decode(sPacket.Data, vecLines);
+      for(const std::string& strLine : vecLines) {
+         if(c_client.GetLinkOptions() & LINK_OPTION_TIMESTAMP) {
+            printf("%10u ", sPacket.Timestamp);
+         }
+         printf("%s\n", strLine.c_str());
+      }
+      if(!bValid) {
+         printf("invalid log packet of %zu bytes\n", sPacket.Data.size());
+      }
+      fflush(stdout);
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+/* Schedules a motion command, sends two motion commands back to back and a stop
+   right after them. The stop is executed on arrival, so the board must discard the
+   motion commands queued or scheduled before it and still stand after the scheduled
+   time. Returns false if the board moves */
+static bool RunStopCheck(CLinkClient& c_client) {
+   const uint8_t punMotion[] = {0x00, 0x20, 0x00, 0x20};
+   const uint8_t punStop[] = {0x00, 0x00, 0x00, 0x00};
+   CLinkClient::SPacket sReply;
+   if(!c_client.Request(static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::PING),
+                        std::vector<uint8_t>(1, PING_FLAG_TIMESTAMPS),
+                        sReply,
+                        REQUEST_TIMEOUT) ||
+      sReply.Data.size() != 1 + PING_TIMESTAMPS_SIZE) {
+      printf("stop: no reply to the ping\n");
+      return false;
+   }
+   /* the transmit time of the board */
+   uint32_t unTime = 0;
+   for(size_t unIdx = 5; unIdx < 1 + PING_TIMESTAMPS_SIZE; unIdx++) {
+      unTime = (unTime << 8) | sReply.Data[unIdx];
+   }
+   unTime += STOP_CHECK_SCHEDULE_DELAY;
+   std::vector<uint8_t> vecSchedule = {
+      static_cast<uint8_t>(unTime >> 24),
+      static_cast<uint8_t>(unTime >> 16),
+      static_cast<uint8_t>(unTime >> 8),
+      static_cast<uint8_t>(unTime >> 0),
+      static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::SET_DDS_SPEED),
+      punMotion[0], punMotion[1], punMotion[2], punMotion[3]
+   };
+   if(!c_client.Request(static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::SCHEDULE_COMMAND),
+                        vecSchedule,
+                        sReply,
+                        REQUEST_TIMEOUT) ||
+      sReply.Data.size() != 1 || sReply.Data[0] != 1) {
+      printf("stop: the board did not accept the scheduled command\n");
+      return false;
+   }
+   for(unsigned unIdx = 0; unIdx < 2; unIdx++) {
+      c_client.SendPacket(static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::SET_DDS_SPEED),
+                          std::vector<uint8_t>(punMotion, punMotion + sizeof(punMotion)));
+   }
+   c_client.SendPacket(static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::SET_DDS_SPEED),
+                       std::vector<uint8_t>(punStop, punStop + sizeof(punStop)));
+   /* wait past the scheduled time, retransmitting the frames that are not acknowledged */
+   while(c_client.ReceivePacket(sReply, 2 * STOP_CHECK_SCHEDULE_DELAY)) {}
+   if(!c_client.Request(static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::GET_DDS_SPEED),
+                        std::vector<uint8_t>(),
+                        sReply,
+                        REQUEST_TIMEOUT) ||
+      sReply.Data.size() != sizeof(punStop)) {
+      printf("stop: no reply to the speed request\n");
+      return false;
+   }
+   bool bStopped = std::equal(sReply.Data.begin(), sReply.Data.end(), punStop);
+   printf("stop: %s\n", bStopped ? "the queued and scheduled motion commands were discarded" :
+                                    "the board executed a motion command after the stop");
+   if(!bStopped) {
+      c_client.SendPacket(static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::SET_DDS_SPEED),
+                          std::vector<uint8_t>(punStop, punStop + sizeof(punStop)));
+   }
+   return bStopped;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+int main(int n_argc, char** ppch_argv) {
+   SConfiguration sConfiguration;
+   if(!ParseArguments(n_argc, ppch_argv, sConfiguration)) {
+      PrintUsage(ppch_argv[0]);
+      return 1;
+   }
+   for(unsigned unSize : sConfiguration.Sizes) {
+      if(unSize < PING_ID_SIZE || unSize + 1 > FRAGMENT_BUFFER_LENGTH) {
+         fprintf(stderr, "payload sizes must be between %u and %u bytes\n",
+                 PING_ID_SIZE, FRAGMENT_BUFFER_LENGTH - 1);
+         return 1;
+      }
+   }
+
+   std::unique_ptr<CTransport> pcTransport;
+   if(sConfiguration.Simulate) {
+      CSimulatedBoard* pcSimulatedBoard = new CSimulatedBoard(sConfiguration.BaudRate);
+      pcTransport.reset(pcSimulatedBoard);
+      if(sConfiguration.StopCheck) {
+         pcSimulatedBoard->SetPacketTime(STOP_CHECK_PACKET_TIME);
+      }
+   }
+   else {
+      CSerialTransport* pcSerialTransport = new CSerialTransport;
+      pcTransport.reset(pcSerialTransport);
+      if(!pcSerialTransport->Open(sConfiguration.Port,
+                                  sConfiguration.BaudRate,
+                                  sConfiguration.FlowControl)) {
+         fprintf(stderr, "cannot open %s at %u baud\n", sConfiguration.Port, sConfiguration.BaudRate);
+         return 1;
+      }
+   }
+   CLinkClient cClient(*pcTransport);
+   /* the board acknowledges the frames late, or after receiving a full window */
+   uint32_t unFrameTime = 10000000ull * RX_COMMAND_BUFFER_LENGTH / sConfiguration.BaudRate;
+   cClient.SetRetransmitTimeout(LINK_ACK_DELAY + 2 * RX_WINDOW_SIZE * unFrameTime + HOST_LATENCY);
+
+   /* the board is expected to use the legacy framing */
+   if(!NegotiateLinkOptions(cClient, sConfiguration.LinkOptions)) {
+      fprintf(stderr, "the board did not accept the link options 0x%02x\n", sConfiguration.LinkOptions);
+      NegotiateLinkOptions(cClient, 0);
+      return 1;
+   }
+   CLinkClient::SPacket sReply;
+   cClient.Request(static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::GET_LINK_STATS),
+                   std::vector<uint8_t>(1, 1), sReply, REQUEST_TIMEOUT);
+
+   printf("%s at %u baud, link options 0x%02x%s\n",
+          sConfiguration.Simulate ? "simulated board" : sConfiguration.Port,
+          sConfiguration.BaudRate,
+          sConfiguration.LinkOptions,
+          sConfiguration.Timestamps ? ", board times" : "");
+   if(sConfiguration.Log) {
+      RunLogMonitor(cClient);
+   }
+   if(sConfiguration.StopCheck) {
+      bool bStopped = RunStopCheck(cClient);
+      NegotiateLinkOptions(cClient, 0);
+      return bStopped ? 0 : 1;
+   }
+   if(sConfiguration.Sync) {
+      RunClockSync(*pcTransport, cClient, sConfiguration.Count);
+   }
+   printf("%6s %6s %6s %6s %10s %10s %12s%s\n",
+          "size", "depth", "sent", "lost", "rtt p50", "rtt p99", "payload B/s",
+          sConfiguration.Timestamps ? "   board p50" : "");
+   for(unsigned unSize : sConfiguration.Sizes) {
+      for(unsigned unDepth : sConfiguration.Depths) {
+         SResult sResult = RunPings(*pcTransport, cClient, sConfiguration, unSize, unDepth);
+         printf("%6u %6u %6u %6u %8uus %8uus %12.0f",
+                unSize, unDepth, sResult.Sent, sResult.Lost,
+                GetPercentile(sResult.RoundTripTimes, 50),
+                GetPercentile(sResult.RoundTripTimes, 99),
+                (sResult.Duration != 0) ? 1e6 * sResult.PayloadBytes / sResult.Duration : 0.0);
+         if(sConfiguration.Timestamps) {
+            printf(" %10uus", GetPercentile(sResult.BoardTimes, 50));
+         }
+         printf("\n");
+         /* a frame takes time to arrive, so the board cannot reply in zero time */
+         if(sConfiguration.Timestamps && !sResult.BoardTimes.empty() &&
+            GetPercentile(sResult.BoardTimes, 50) == 0) {
+            fprintf(stderr, "warning: the board reports no processing time, its receive "
+                            "time is not the arrival time of the request\n");
+         }
+      }
+   }
+
+   /* link counters of the board over all runs */
+   if(cClient.Request(static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::GET_LINK_STATS),
+                      std::vector<uint8_t>(), sReply, REQUEST_TIMEOUT) &&
+      sReply.Data.size() >= 10) {
+      const char* ppchNames[] = {
+         "bytes", "frames", "checksum errors", "discarded bytes", "queue overflows"
+      };
+      printf("board:");
+      for(size_t unIdx = 0; unIdx < sizeof(ppchNames) / sizeof(ppchNames[0]); unIdx++) {
+         printf(" %s %u%s", ppchNames[unIdx],
+                (sReply.Data[2 * unIdx] << 8) | sReply.Data[2 * unIdx + 1],
+                (unIdx + 1 < sizeof(ppchNames) / sizeof(ppchNames[0])) ? "," : "\n");
+      }
+   }
+   printf("host: checksum errors %u, retransmitted frames %u\n",
+          cClient.GetChecksumErrorCount(), cClient.GetRetransmitCount());
+
+   NegotiateLinkOptions(cClient, 0);
+   return 0;
+}
+
+/***********************************************************/
+/***********************************************************/
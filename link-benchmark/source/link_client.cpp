@@ -0,0 +1,405 @@
+
+#include "link_client.h"
+
+#include <util/crc16.h>
+
+#include <algorithm>
+
+/***********************************************************/
+/***********************************************************/
+
+void CLinkClient::SetLinkOptions(uint8_t un_link_options) {
+   m_unLinkOptions = un_link_options;
+   m_unTxSequence = 0;
+   m_unFragmentIndex = 0;
+   m_vecRxBytes.clear();
+   m_cUnacknowledgedFrames.clear();
+}
+
+/***********************************************************/
+/***********************************************************/
+
+uint8_t CLinkClient::GetMaximumTxDataLength() const {
+   /* the frames must fit into the receive buffer of the firmware */
+   uint8_t unMaximumTxDataLength = RX_COMMAND_BUFFER_LENGTH - NON_DATA_SIZE;
+   if(m_unLinkOptions & LINK_OPTION_CRC) {
+      unMaximumTxDataLength -= CRC_MODE_EXTRA_SIZE;
+   }
+   if(m_unLinkOptions & LINK_OPTION_TAG) {
+      unMaximumTxDataLength -= TAG_FIELD_SIZE;
+   }
+   return unMaximumTxDataLength;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+uint8_t CLinkClient::GetHeaderLength() const {
+   /* the fields between the preamble and the type in the frames of the board */
+   uint8_t unHeaderLength = 0;
+   if(m_unLinkOptions & LINK_OPTION_CRC) {
+      unHeaderLength += SEQUENCE_FIELD_SIZE;
+   }
+   if(m_unLinkOptions & LINK_OPTION_TAG) {
+      unHeaderLength += TAG_FIELD_SIZE;
+   }
+   if(m_unLinkOptions & LINK_OPTION_TIMESTAMP) {
+      unHeaderLength += TIMESTAMP_FIELD_SIZE;
+   }
+   return unHeaderLength;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CLinkClient::SendPacket(uint8_t un_type,
+                             const std::vector<uint8_t>& c_data,
+                             uint8_t un_tag) {
+   if(c_data.size() <= GetMaximumTxDataLength()) {
+      WriteFrame(un_type, c_data.data(), c_data.size(), un_tag);
+      return;
+   }
+   /* same fragmentation as the firmware, the first fragment starts with the packet type */
+   std::vector<uint8_t> vecFragment;
+   size_t unOffset = 0;
+   uint8_t unIndex = 0;
+   while(unOffset < c_data.size()) {
+      vecFragment.assign(1, unIndex);
+      if(unIndex == 0) {
+         vecFragment.push_back(un_type);
+      }
+      size_t unFragmentLength = GetMaximumTxDataLength() - vecFragment.size();
+      if(unFragmentLength >= c_data.size() - unOffset) {
+         unFragmentLength = c_data.size() - unOffset;
+         vecFragment[0] |= FRAGMENT_LAST;
+      }
+      vecFragment.insert(vecFragment.end(),
+                         c_data.begin() + unOffset,
+                         c_data.begin() + unOffset + unFragmentLength);
+      WriteFrame(static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::FRAGMENT),
+                 vecFragment.data(), vecFragment.size(), un_tag);
+      unOffset += unFragmentLength;
+      unIndex++;
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CLinkClient::WriteFrame(uint8_t un_type,
+                             const uint8_t* pun_data,
+                             uint8_t un_data_length,
+                             uint8_t un_tag) {
+   std::vector<uint8_t> vecFields;
+   if(m_unLinkOptions & LINK_OPTION_CRC) {
+      vecFields.push_back(m_unTxSequence);
+   }
+   if(m_unLinkOptions & LINK_OPTION_TAG) {
+      vecFields.push_back(un_tag);
+   }
+   vecFields.push_back(un_type);
+   vecFields.push_back(un_data_length);
+   vecFields.insert(vecFields.end(), pun_data, pun_data + un_data_length);
+   if(m_unLinkOptions & LINK_OPTION_CRC) {
+      uint16_t unCRC = CRC_INITIAL_VALUE;
+      for(uint8_t unByte : vecFields) {
+         unCRC = _crc_xmodem_update(unCRC, unByte);
+      }
+      vecFields.push_back((unCRC >> 8) & 0xFF);
+      vecFields.push_back((unCRC >> 0) & 0xFF);
+   }
+   else {
+      uint8_t unChecksum = 0;
+      for(uint8_t unByte : vecFields) {
+         unChecksum += unByte;
+      }
+      vecFields.push_back(unChecksum);
+   }
+
+   std::vector<uint8_t> vecFrame;
+   if(m_unLinkOptions & LINK_OPTION_COBS) {
+      /* each zero byte ends a block, which is replaced by the code byte in front of it */
+      size_t unBlockStart = 0;
+      for(size_t unIdx = 0; unIdx <= vecFields.size(); unIdx++) {
+         if(unIdx == vecFields.size() || vecFields[unIdx] == COBS_DELIMITER) {
+            vecFrame.push_back(unIdx - unBlockStart + 1);
+            vecFrame.insert(vecFrame.end(),
+                            vecFields.begin() + unBlockStart,
+                            vecFields.begin() + unIdx);
+            unBlockStart = unIdx + 1;
+         }
+      }
+      vecFrame.push_back(COBS_DELIMITER);
+   }
+   else {
+      vecFrame.push_back(PREAMBLE1);
+      vecFrame.push_back(PREAMBLE2);
+      vecFrame.insert(vecFrame.end(), vecFields.begin(), vecFields.end());
+      vecFrame.push_back(POSTAMBLE1);
+      vecFrame.push_back(POSTAMBLE2);
+   }
+   m_cTransport.Write(vecFrame.data(), vecFrame.size());
+   if(m_unLinkOptions & LINK_OPTION_CRC) {
+      /* keep the frame until the board acknowledges it */
+      m_cUnacknowledgedFrames.push_back(
+         SUnacknowledgedFrame {m_unTxSequence++, m_cTransport.GetMicroseconds(), vecFrame});
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CLinkClient::Acknowledge(const SPacket& s_ack) {
+   if(s_ack.Data.size() != 2) {
+      return;
+   }
+   /* [next expected sequence number, bitmask of the following RX_WINDOW_SIZE] */
+   uint8_t unBase = s_ack.Data[0];
+   uint8_t unMask = s_ack.Data[1];
+   std::deque<SUnacknowledgedFrame>::iterator itFrame = m_cUnacknowledgedFrames.begin();
+   while(itFrame != m_cUnacknowledgedFrames.end()) {
+      int8_t nOffset = static_cast<int8_t>(itFrame->Sequence - unBase);
+      if(nOffset < 0 || (nOffset > 0 && nOffset <= RX_WINDOW_SIZE && (unMask & (1 << (nOffset - 1))))) {
+         itFrame = m_cUnacknowledgedFrames.erase(itFrame);
+      }
+      else {
+         ++itFrame;
+      }
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+uint64_t CLinkClient::Retransmit() {
+   if(m_cUnacknowledgedFrames.empty()) {
+      return UINT64_MAX;
+   }
+   uint64_t unTime = m_cTransport.GetMicroseconds();
+   if(unTime - m_cUnacknowledgedFrames.front().SendTime >= m_unRetransmitTimeout) {
+      /* the board drops a fragment after a missing frame, so the frames are sent again
+         in order from the oldest one */
+      for(SUnacknowledgedFrame& sFrame : m_cUnacknowledgedFrames) {
+         m_cTransport.Write(sFrame.Bytes.data(), sFrame.Bytes.size());
+         sFrame.SendTime = unTime;
+         m_unRetransmitCount++;
+      }
+   }
+   return m_cUnacknowledgedFrames.front().SendTime + m_unRetransmitTimeout;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CLinkClient::ReceivePacket(SPacket& s_packet, uint32_t un_timeout_us) {
+   uint64_t unDeadline = m_cTransport.GetMicroseconds() + un_timeout_us;
+   for(;;) {
+      while(DecodeFrame(s_packet)) {
+         if(s_packet.Type == static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::LINK_ACK)) {
+            Acknowledge(s_packet);
+            continue;
+         }
+         if(Reassemble(s_packet)) {
+            return true;
+         }
+      }
+      /* wake up for the next retransmission */
+      uint64_t unWakeTime = std::min(unDeadline, Retransmit());
+      uint64_t unTime = m_cTransport.GetMicroseconds();
+      if(unTime >= unDeadline) {
+         return false;
+      }
+      uint8_t punRxBytes[256];
+      size_t unLength = m_cTransport.Read(punRxBytes, sizeof(punRxBytes),
+                                          (unWakeTime > unTime) ? unWakeTime - unTime : 0);
+      m_vecRxBytes.insert(m_vecRxBytes.end(), punRxBytes, punRxBytes + unLength);
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CLinkClient::Request(uint8_t un_type,
+                          const std::vector<uint8_t>& c_data,
+                          SPacket& s_reply,
+                          uint32_t un_timeout_us) {
+   SendPacket(un_type, c_data);
+   uint64_t unDeadline = m_cTransport.GetMicroseconds() + un_timeout_us;
+   for(;;) {
+      uint64_t unTime = m_cTransport.GetMicroseconds();
+      if(unTime >= unDeadline || !ReceivePacket(s_reply, unDeadline - unTime)) {
+         return false;
+      }
+      if(s_reply.Type == un_type) {
+         return true;
+      }
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CLinkClient::DecodeFrame(SPacket& s_packet) {
+   if(m_unLinkOptions & LINK_OPTION_COBS) {
+      for(;;) {
+         std::vector<uint8_t>::iterator itDelimiter =
+            std::find(m_vecRxBytes.begin(), m_vecRxBytes.end(), COBS_DELIMITER);
+         if(itDelimiter == m_vecRxBytes.end()) {
+            return false;
+         }
+         /* an empty or truncated block invalidates the frame */
+         std::vector<uint8_t> vecFields;
+         std::vector<uint8_t>::iterator itBlock = m_vecRxBytes.begin();
+         bool bValid = (itBlock != itDelimiter);
+         while(bValid && itBlock != itDelimiter) {
+            uint8_t unCode = *itBlock++;
+            if(unCode - 1 > itDelimiter - itBlock) {
+               bValid = false;
+               break;
+            }
+            vecFields.insert(vecFields.end(), itBlock, itBlock + unCode - 1);
+            itBlock += unCode - 1;
+            if(itBlock != itDelimiter && unCode != COBS_MAXIMUM_BLOCK_CODE) {
+               vecFields.push_back(COBS_DELIMITER);
+            }
+         }
+         m_vecRxBytes.erase(m_vecRxBytes.begin(), itDelimiter + 1);
+         if(bValid && DecodeFields(vecFields.data(), vecFields.size(), s_packet)) {
+            return true;
+         }
+      }
+   }
+   else {
+      uint8_t unHeaderLength = GetHeaderLength();
+      uint8_t unCheckLength =
+         (m_unLinkOptions & LINK_OPTION_CRC) ? CRC_FIELD_SIZE : CHECKSUM_FIELD_SIZE;
+      size_t unLengthOffset = PREAMBLE_SIZE + unHeaderLength + TYPE_FIELD_SIZE;
+      for(;;) {
+         /* drop the bytes before the next preamble */
+         size_t unStart = 0;
+         while(unStart + 1 < m_vecRxBytes.size() &&
+               !(m_vecRxBytes[unStart] == PREAMBLE1 && m_vecRxBytes[unStart + 1] == PREAMBLE2)) {
+            unStart++;
+         }
+         m_vecRxBytes.erase(m_vecRxBytes.begin(), m_vecRxBytes.begin() + unStart);
+         if(m_vecRxBytes.size() <= unLengthOffset) {
+            return false;
+         }
+         size_t unFrameLength = unLengthOffset + DATA_LENGTH_FIELD_SIZE +
+            m_vecRxBytes[unLengthOffset] + unCheckLength + POSTAMBLE_SIZE;
+         if(m_vecRxBytes.size() < unFrameLength) {
+            return false;
+         }
+         if(m_vecRxBytes[unFrameLength - 2] == POSTAMBLE1 &&
+            m_vecRxBytes[unFrameLength - 1] == POSTAMBLE2 &&
+            DecodeFields(&m_vecRxBytes[PREAMBLE_SIZE],
+                         unFrameLength - PREAMBLE_SIZE - POSTAMBLE_SIZE,
+                         s_packet)) {
+            m_vecRxBytes.erase(m_vecRxBytes.begin(), m_vecRxBytes.begin() + unFrameLength);
+            return true;
+         }
+         /* not a frame, search the next preamble */
+         m_vecRxBytes.erase(m_vecRxBytes.begin());
+      }
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CLinkClient::DecodeFields(const uint8_t* pun_fields, size_t un_fields_length, SPacket& s_packet) {
+   bool bUseCRC = (m_unLinkOptions & LINK_OPTION_CRC);
+   size_t unCheckLength = bUseCRC ? CRC_FIELD_SIZE : CHECKSUM_FIELD_SIZE;
+   size_t unOffset = GetHeaderLength();
+   if(un_fields_length < unOffset + TYPE_FIELD_SIZE + DATA_LENGTH_FIELD_SIZE + unCheckLength) {
+      return false;
+   }
+   size_t unHeaderOffset = bUseCRC ? SEQUENCE_FIELD_SIZE : 0;
+   s_packet.Tag = 0;
+   if(m_unLinkOptions & LINK_OPTION_TAG) {
+      s_packet.Tag = pun_fields[unHeaderOffset];
+      unHeaderOffset += TAG_FIELD_SIZE;
+   }
+   s_packet.Timestamp = 0;
+   if(m_unLinkOptions & LINK_OPTION_TIMESTAMP) {
+      for(size_t unIdx = 0; unIdx < TIMESTAMP_FIELD_SIZE; unIdx++) {
+         s_packet.Timestamp = (s_packet.Timestamp << 8) | pun_fields[unHeaderOffset + unIdx];
+      }
+   }
+   if(un_fields_length != unOffset + TYPE_FIELD_SIZE + DATA_LENGTH_FIELD_SIZE +
+                          pun_fields[unOffset + TYPE_FIELD_SIZE] + unCheckLength) {
+      return false;
+   }
+   size_t unCheckOffset = un_fields_length - unCheckLength;
+   if(bUseCRC) {
+      uint16_t unCRC = CRC_INITIAL_VALUE;
+      for(size_t unIdx = 0; unIdx < unCheckOffset; unIdx++) {
+         unCRC = _crc_xmodem_update(unCRC, pun_fields[unIdx]);
+      }
+      if(pun_fields[unCheckOffset] != ((unCRC >> 8) & 0xFF) ||
+         pun_fields[unCheckOffset + 1] != ((unCRC >> 0) & 0xFF)) {
+         m_unChecksumErrorCount++;
+         return false;
+      }
+   }
+   else {
+      uint8_t unChecksum = 0;
+      for(size_t unIdx = 0; unIdx < unCheckOffset; unIdx++) {
+         unChecksum += pun_fields[unIdx];
+      }
+      if(pun_fields[unCheckOffset] != unChecksum) {
+         m_unChecksumErrorCount++;
+         return false;
+      }
+   }
+   s_packet.Type = pun_fields[unOffset];
+   s_packet.Data.assign(pun_fields + unOffset + TYPE_FIELD_SIZE + DATA_LENGTH_FIELD_SIZE,
+                        pun_fields + unCheckOffset);
+   return true;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CLinkClient::Reassemble(SPacket& s_packet) {
+   if(s_packet.Type != static_cast<uint8_t>(CPacketControlInterface::CPacket::EType::FRAGMENT)) {
+      return true;
+   }
+   if(s_packet.Data.empty()) {
+      m_unFragmentIndex = 0;
+      return false;
+   }
+   uint8_t unIndex = s_packet.Data[0] & FRAGMENT_INDEX_MASK;
+   size_t unDataOffset = 1;
+   if(unIndex == 0) {
+      /* the first fragment, drop any incomplete packet */
+      if(s_packet.Data.size() < 2) {
+         m_unFragmentIndex = 0;
+         return false;
+      }
+      m_sFragment.Type = s_packet.Data[1];
+      m_sFragment.Data.clear();
+      unDataOffset = 2;
+   }
+   else if(unIndex != m_unFragmentIndex) {
+      /* a fragment is missing */
+      m_unFragmentIndex = 0;
+      return false;
+   }
+   m_sFragment.Data.insert(m_sFragment.Data.end(),
+                           s_packet.Data.begin() + unDataOffset,
+                           s_packet.Data.end());
+   m_unFragmentIndex = unIndex + 1;
+   if(!(s_packet.Data[0] & FRAGMENT_LAST)) {
+      return false;
+   }
+   /* the tag of the last fragment is used */
+   m_sFragment.Tag = s_packet.Tag;
+   m_sFragment.Timestamp = s_packet.Timestamp;
+   m_unFragmentIndex = 0;
+   s_packet = m_sFragment;
+   return true;
+}
+
+/***********************************************************/
+/***********************************************************/
@@ -0,0 +1,124 @@
+#ifndef LINK_CLIENT_H
+#define LINK_CLIENT_H
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+#include <packet_control_interface.h>
+
+#include <transport.h>
+
+/* Host side of the link layer of the firmwares: frames packets with the link options
+   in effect, splits long packets into fragments and reassembles the received ones.
+   In CRC mode, the frames that the board has not acknowledged with a LINK_ACK packet
+   are sent again with their sequence numbers after the retransmit timeout */
+class CLinkClient {
+
+public:
+   struct SPacket {
+      uint8_t Type;
+      uint8_t Tag;
+      /* time of the board in microseconds, with LINK_OPTION_TIMESTAMP */
+      uint32_t Timestamp;
+      std::vector<uint8_t> Data;
+   };
+
+public:
+   CLinkClient(CTransport& c_transport) :
+      m_cTransport(c_transport),
+      m_unLinkOptions(0),
+      m_unTxSequence(0),
+      m_unChecksumErrorCount(0),
+      m_unRetransmitTimeout(DEFAULT_RETRANSMIT_TIMEOUT),
+      m_unRetransmitCount(0),
+      m_unFragmentIndex(0) {}
+
+   /* Changes the framing of the client, the board is switched by SET_LINK_OPTIONS */
+   void SetLinkOptions(uint8_t un_link_options);
+
+   uint8_t GetLinkOptions() const {
+      return m_unLinkOptions;
+   }
+
+   /* Largest data length of a packet that is sent in a single frame */
+   uint8_t GetMaximumTxDataLength() const;
+
+   void SendPacket(uint8_t un_type,
+                   const std::vector<uint8_t>& c_data,
+                   uint8_t un_tag = 0);
+
+   /* The timeout should cover LINK_ACK_DELAY and the time to receive a full queue
+      of frames at the baud rate */
+   void SetRetransmitTimeout(uint32_t un_timeout_us) {
+      m_unRetransmitTimeout = un_timeout_us;
+   }
+
+   /* Waits up to un_timeout_us for a packet and retransmits the frames that are due
+      meanwhile. LINK_ACK packets are consumed by the client */
+   bool ReceivePacket(SPacket& s_packet, uint32_t un_timeout_us);
+
+   /* Sends a request and waits for the reply of the same type */
+   bool Request(uint8_t un_type,
+                const std::vector<uint8_t>& c_data,
+                SPacket& s_reply,
+                uint32_t un_timeout_us);
+
+   /* Frames that were discarded because of their checksum or CRC */
+   uint32_t GetChecksumErrorCount() const {
+      return m_unChecksumErrorCount;
+   }
+
+   /* Frames that were sent again because they were not acknowledged in time */
+   uint32_t GetRetransmitCount() const {
+      return m_unRetransmitCount;
+   }
+
+   static const uint32_t DEFAULT_RETRANSMIT_TIMEOUT = 100000;
+
+private:
+   void WriteFrame(uint8_t un_type,
+                   const uint8_t* pun_data,
+                   uint8_t un_data_length,
+                   uint8_t un_tag);
+
+   /* Length of the sequence number, tag and timestamp fields of the received frames */
+   uint8_t GetHeaderLength() const;
+
+   /* Extracts the next valid frame from the received bytes */
+   bool DecodeFrame(SPacket& s_packet);
+
+   /* Checks the fields between the preamble and the postamble of a frame */
+   bool DecodeFields(const uint8_t* pun_fields, size_t un_fields_length, SPacket& s_packet);
+
+   /* Returns true once a packet is complete, fragments are collected in m_sFragment */
+   bool Reassemble(SPacket& s_packet);
+
+   /* Forgets the frames acknowledged by a LINK_ACK packet */
+   void Acknowledge(const SPacket& s_ack);
+
+   /* Sends the unacknowledged frames again if the oldest one is due, in order, and
+      returns the time of the next retransmission */
+   uint64_t Retransmit();
+
+   CTransport& m_cTransport;
+   uint8_t m_unLinkOptions;
+   uint8_t m_unTxSequence;
+   uint32_t m_unChecksumErrorCount;
+   /* frames sent in CRC mode that were not acknowledged yet, oldest first */
+   struct SUnacknowledgedFrame {
+      uint8_t Sequence;
+      uint64_t SendTime;
+      std::vector<uint8_t> Bytes;
+   };
+   std::deque<SUnacknowledgedFrame> m_cUnacknowledgedFrames;
+   uint32_t m_unRetransmitTimeout;
+   uint32_t m_unRetransmitCount;
+   /* received bytes that were not decoded yet */
+   std::vector<uint8_t> m_vecRxBytes;
+   /* packet being reassembled, a zero index means no fragment was received */
+   uint8_t m_unFragmentIndex;
+   SPacket m_sFragment;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#include "log_decoder.h"
+
+#include <stdio.h>
+
+/***********************************************************/
+/***********************************************************/
+
+/* largest number of arguments of a message that can be formatted */
+#define MAXIMUM_ARGUMENT_COUNT 8
+
+struct SMessage {
+   const char* Name;
+   uint8_t ArgumentCount;
+   const char* Format;
+};
+
+static const SMessage s_psMessages[] = {
+#define LOG_MESSAGE(ID, ARGUMENT_COUNT, FORMAT) {#ID, ARGUMENT_COUNT, FORMAT},
+#include <log_messages.def>
+#undef LOG_MESSAGE
+};
+
+/***********************************************************/
+/***********************************************************/
+
+bool CLogDecoder::Decode(const std::vector<uint8_t>& vec_data,
+                         std::vector<std::string>& vec_lines) {
+   if(vec_data.empty()) {
+      return false;
+   }
+   char pchLine[256];
+   if(vec_data[0] != 0) {
+      snprintf(pchLine, sizeof(pchLine), "%u records dropped", vec_data[0]);
+      vec_lines.push_back(pchLine);
+   }
+   size_t unOffset = 1;
+   while(unOffset < vec_data.size()) {
+      uint8_t unId = vec_data[unOffset++];
+      if(unId >= sizeof(s_psMessages) / sizeof(s_psMessages[0])) {
+         return false;
+      }
+      const SMessage& sMessage = s_psMessages[unId];
+      if(sMessage.ArgumentCount > MAXIMUM_ARGUMENT_COUNT ||
+         unOffset + sMessage.ArgumentCount > vec_data.size()) {
+         return false;
+      }
+      unsigned punArguments[MAXIMUM_ARGUMENT_COUNT] = {};
+      for(uint8_t unIdx = 0; unIdx < sMessage.ArgumentCount; unIdx++) {
+         punArguments[unIdx] = vec_data[unOffset++];
+      }
+      /* the conversions of the format use as many arguments as the message has */
+      int nLength = snprintf(pchLine, sizeof(pchLine), "%s: ", sMessage.Name);
+      snprintf(pchLine + nLength, sizeof(pchLine) - nLength, sMessage.Format,
+               punArguments[0], punArguments[1], punArguments[2], punArguments[3],
+               punArguments[4], punArguments[5], punArguments[6], punArguments[7]);
+      vec_lines.push_back(pchLine);
+   }
+   return true;
+}
+
+/***********************************************************/
+/***********************************************************/
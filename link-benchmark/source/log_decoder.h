@@ -0,0 +1,19 @@
+#ifndef LOG_DECODER_H
+#define LOG_DECODER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Formats the records of the LOG packets of the firmwares with log_messages.def,
+   the table the firmwares are built with, see CLog */
+class CLogDecoder {
+
+public:
+   /* Appends a line per record and per report of dropped records to vec_lines.
+      Returns false if a record has an unknown id or is incomplete */
+   static bool Decode(const std::vector<uint8_t>& vec_data,
+                      std::vector<std::string>& vec_lines);
+};
+
+#endif
@@ -0,0 +1,109 @@
+
+#include "serial_transport.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/***********************************************************/
+/***********************************************************/
+
+CSerialTransport::CSerialTransport() :
+   m_nFileDescriptor(-1) {}
+
+/***********************************************************/
+/***********************************************************/
+
+CSerialTransport::~CSerialTransport() {
+   if(m_nFileDescriptor >= 0) {
+      close(m_nFileDescriptor);
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CSerialTransport::Open(const char* pch_device, uint32_t un_baud_rate, bool b_flow_control) {
+   speed_t tSpeed;
+   switch(un_baud_rate) {
+   case 9600: tSpeed = B9600; break;
+   case 19200: tSpeed = B19200; break;
+   case 38400: tSpeed = B38400; break;
+   case 57600: tSpeed = B57600; break;
+   case 115200: tSpeed = B115200; break;
+   case 230400: tSpeed = B230400; break;
+#ifdef B500000
+   case 500000: tSpeed = B500000; break;
+#endif
+#ifdef B1000000
+   case 1000000: tSpeed = B1000000; break;
+#endif
+   default:
+      return false;
+   }
+   m_nFileDescriptor = open(pch_device, O_RDWR | O_NOCTTY);
+   if(m_nFileDescriptor < 0) {
+      return false;
+   }
+   struct termios sTermios;
+   if(tcgetattr(m_nFileDescriptor, &sTermios) != 0) {
+      return false;
+   }
+   cfmakeraw(&sTermios);
+   cfsetispeed(&sTermios, tSpeed);
+   cfsetospeed(&sTermios, tSpeed);
+   sTermios.c_cflag |= (CLOCAL | CREAD);
+   if(b_flow_control) {
+      sTermios.c_cflag |= CRTSCTS;
+   }
+   else {
+      sTermios.c_cflag &= ~CRTSCTS;
+   }
+   sTermios.c_cc[VMIN] = 0;
+   sTermios.c_cc[VTIME] = 0;
+   if(tcsetattr(m_nFileDescriptor, TCSANOW, &sTermios) != 0) {
+      return false;
+   }
+   tcflush(m_nFileDescriptor, TCIOFLUSH);
+   return true;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CSerialTransport::Write(const uint8_t* pun_data, size_t un_length) {
+   while(un_length > 0) {
+      ssize_t nWritten = write(m_nFileDescriptor, pun_data, un_length);
+      if(nWritten <= 0) {
+         return;
+      }
+      pun_data += nWritten;
+      un_length -= nWritten;
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
+
+size_t CSerialTransport::Read(uint8_t* pun_data, size_t un_length, uint32_t un_timeout_us) {
+   struct pollfd sPollFd = {m_nFileDescriptor, POLLIN, 0};
+   if(poll(&sPollFd, 1, (un_timeout_us + 999) / 1000) <= 0) {
+      return 0;
+   }
+   ssize_t nRead = read(m_nFileDescriptor, pun_data, un_length);
+   return (nRead > 0) ? nRead : 0;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+uint64_t CSerialTransport::GetMicroseconds() {
+   struct timespec sTime;
+   clock_gettime(CLOCK_MONOTONIC, &sTime);
+   return static_cast<uint64_t>(sTime.tv_sec) * 1000000 + sTime.tv_nsec / 1000;
+}
+
+/***********************************************************/
+/***********************************************************/
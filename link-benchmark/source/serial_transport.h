@@ -0,0 +1,27 @@
+#ifndef SERIAL_TRANSPORT_H
+#define SERIAL_TRANSPORT_H
+
+#include <transport.h>
+
+/* Serial port of a real board, e.g. /dev/ttyUSB0 */
+class CSerialTransport : public CTransport {
+public:
+   CSerialTransport();
+
+   ~CSerialTransport();
+
+   /* Returns false if the device cannot be opened or the baud rate is not supported.
+      With b_flow_control, the host only sends while its CTS input is asserted */
+   bool Open(const char* pch_device, uint32_t un_baud_rate, bool b_flow_control);
+
+   void Write(const uint8_t* pun_data, size_t un_length);
+
+   size_t Read(uint8_t* pun_data, size_t un_length, uint32_t un_timeout_us);
+
+   uint64_t GetMicroseconds();
+
+private:
+   int m_nFileDescriptor;
+};
+
+#endif
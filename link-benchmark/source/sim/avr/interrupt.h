@@ -0,0 +1,13 @@
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+/* The simulated board calls the interrupt routines between the iterations of
+   its main loop, so that disabling the interrupts has no effect */
+inline void cli() {}
+inline void sei() {}
+
+#define ISR(vector, ...) extern "C" void vector(void)
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef FIRMWARE_H
+#define FIRMWARE_H
+
+/* Stand-in for the firmware header included by the shared link layer, which
+   only requires the AVR definitions when it is built for the simulated board */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef SIM_UTIL_CRC16_H
+#define SIM_UTIL_CRC16_H
+
+#include <stdint.h>
+
+/* Same results as the avr-libc implementation */
+static inline uint16_t _crc_xmodem_update(uint16_t un_crc, uint8_t un_data) {
+   un_crc ^= static_cast<uint16_t>(un_data) << 8;
+   for(uint8_t unBit = 0; unBit < 8; unBit++) {
+      un_crc = (un_crc & 0x8000) ? ((un_crc << 1) ^ 0x1021) : (un_crc << 1);
+   }
+   return un_crc;
+}
+
+#endif
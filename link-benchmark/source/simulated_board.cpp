@@ -0,0 +1,204 @@
+
+#include "simulated_board.h"
+
+#include <avr/io.h>
+
+/* registers of the ATmega328P accessed by the UART controller */
+volatile uint8_t SREG;
+volatile uint8_t UBRR0H;
+volatile uint8_t UBRR0L;
+volatile uint8_t UCSR0A;
+volatile uint8_t UCSR0B;
+volatile uint8_t UCSR0C;
+volatile uint8_t UDR0;
+
+extern "C" void USART_RX_vect(void);
+extern "C" void USART_UDRE_vect(void);
+
+/* board whose virtual time is the clock of the timestamps, there is a single UART */
+static CSimulatedBoard* s_pcSimulatedBoard = nullptr;
+
+/***********************************************************/
+/***********************************************************/
+
+CSimulatedBoard::CSimulatedBoard(uint32_t un_baud_rate) :
+   m_cPacketControlInterface(CHUARTController::instance()),
+   m_unTime(0),
+   m_unByteTime(10000000000ull / un_baud_rate),
+   m_unPacketTime(0),
+   m_unBusyTime(0),
+   m_punSpeed(),
+   m_cEmergencyStopHandler(m_punSpeed) {
+   CHUARTController::instance().Begin(un_baud_rate);
+   s_pcSimulatedBoard = this;
+   m_cPacketControlInterface.SetUrgentPacketHandler(&m_cEmergencyStopHandler);
+   m_cPacketControlInterface.SetClock([] {
+      return static_cast<uint32_t>(s_pcSimulatedBoard->GetMicroseconds());
+   });
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CSimulatedBoard::Write(const uint8_t* pun_data, size_t un_length) {
+   m_cRxBytes.insert(m_cRxBytes.end(), pun_data, pun_data + un_length);
+}
+
+/***********************************************************/
+/***********************************************************/
+
+size_t CSimulatedBoard::Read(uint8_t* pun_data, size_t un_length, uint32_t un_timeout_us) {
+   uint64_t unDeadline = m_unTime + static_cast<uint64_t>(un_timeout_us) * 1000;
+   while(m_cTxBytes.empty() && m_unTime < unDeadline) {
+      Step();
+   }
+   size_t unRead = 0;
+   while(unRead < un_length && !m_cTxBytes.empty()) {
+      pun_data[unRead++] = m_cTxBytes.front();
+      m_cTxBytes.pop_front();
+   }
+   return unRead;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CSimulatedBoard::Step() {
+   m_unTime += m_unByteTime;
+   if(!m_cRxBytes.empty()) {
+      UCSR0A &= ~(_BV(FE0) | _BV(DOR0) | _BV(UPE0));
+      UDR0 = m_cRxBytes.front();
+      m_cRxBytes.pop_front();
+      USART_RX_vect();
+   }
+   /* the interrupt disables itself once the transmit buffer is empty */
+   while(UCSR0B & _BV(UDRIE0)) {
+      USART_UDRE_vect();
+      if(UCSR0B & _BV(UDRIE0)) {
+         m_cTxBytes.push_back(static_cast<uint8_t>(UDR0));
+         break;
+      }
+   }
+   if(UCSR0B & _BV(UDRIE0)) {
+      UCSR0A &= ~_BV(TXC0);
+   }
+   else {
+      UCSR0A |= _BV(TXC0);
+   }
+   /* one iteration of the main loop, unless it is still executing a packet */
+   if(m_unTime < m_unBusyTime) {
+      return;
+   }
+   m_cPacketControlInterface.ProcessInput();
+   if(m_cPacketControlInterface.GetState() == CPacketControlInterface::EState::RECV_COMMAND) {
+      ExecutePacket(m_cPacketControlInterface.GetPacket());
+   }
+   CPacketControlInterface::CPacket cScheduledPacket(0xFF, 0, nullptr);
+   if(m_cPacketControlInterface.GetDueCommand(static_cast<uint32_t>(GetMicroseconds()), cScheduledPacket)) {
+      ExecutePacket(cScheduledPacket);
+   }
+   m_cPacketControlInterface.SendLog(CLog::GetInstance());
+}
+
+/***********************************************************/
+/***********************************************************/
+
+bool CSimulatedBoard::CEmergencyStopHandler::HandleUrgentPacket(const CPacketControlInterface::CPacket& c_packet) {
+   /* same as the zero speed request of firmware-sensact */
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   if(c_packet.GetType() == CPacketControlInterface::CPacket::EType::SET_DDS_SPEED &&
+      c_packet.GetDataLength() == 4 &&
+      (punRxData[0] | punRxData[1] | punRxData[2] | punRxData[3]) == 0) {
+      for(uint8_t unIdx = 0; unIdx < 4; unIdx++) {
+         m_punSpeed[unIdx] = 0;
+      }
+      return true;
+   }
+   return false;
+}
+
+/***********************************************************/
+/***********************************************************/
+
+void CSimulatedBoard::ExecutePacket(const CPacketControlInterface::CPacket& c_packet) {
+   const uint8_t* punRxData = c_packet.GetDataPointer();
+   m_unBusyTime = m_unTime + m_unPacketTime;
+   switch(c_packet.GetType()) {
+   case CPacketControlInterface::CPacket::EType::SET_DDS_SPEED:
+      if(c_packet.GetDataLength() == 4) {
+         for(uint8_t unIdx = 0; unIdx < 4; unIdx++) {
+            m_punSpeed[unIdx] = punRxData[unIdx];
+         }
+      }
+      break;
+   case CPacketControlInterface::CPacket::EType::GET_DDS_SPEED:
+      m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::GET_DDS_SPEED,
+                                           m_punSpeed,
+                                           sizeof(m_punSpeed));
+      break;
+   case CPacketControlInterface::CPacket::EType::SCHEDULE_COMMAND:
+      /* same as CFirmware::HandleScheduleCommand, with the virtual time */
+      if(c_packet.GetDataLength() >= SCHEDULE_TIME_FIELD_SIZE + TYPE_FIELD_SIZE) {
+         uint32_t unTime = (static_cast<uint32_t>(punRxData[0]) << 24) |
+                           (static_cast<uint32_t>(punRxData[1]) << 16) |
+                           (static_cast<uint32_t>(punRxData[2]) << 8) |
+                           (static_cast<uint32_t>(punRxData[3]) << 0);
+         bool bAccepted = m_cPacketControlInterface.ScheduleCommand(
+            unTime,
+            punRxData[SCHEDULE_TIME_FIELD_SIZE],
+            &punRxData[SCHEDULE_TIME_FIELD_SIZE + TYPE_FIELD_SIZE],
+            c_packet.GetDataLength() - SCHEDULE_TIME_FIELD_SIZE - TYPE_FIELD_SIZE);
+         m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::SCHEDULE_COMMAND,
+                                              bAccepted ? 1 : 0);
+      }
+      else {
+         m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::SCHEDULE_COMMAND,
+                                              0);
+      }
+      break;
+   case CPacketControlInterface::CPacket::EType::SET_LINK_OPTIONS:
+      if(c_packet.GetDataLength() == 1) {
+         uint8_t unLinkOptions = punRxData[0] & SUPPORTED_LINK_OPTIONS;
+         m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::SET_LINK_OPTIONS,
+                                              unLinkOptions);
+         m_cPacketControlInterface.SetLinkOptions(unLinkOptions);
+      }
+      break;
+   case CPacketControlInterface::CPacket::EType::GET_LINK_STATS:
+      if(c_packet.GetDataLength() <= 1) {
+         m_cPacketControlInterface.SendLinkStatistics(c_packet.HasData() && punRxData[0] != 0);
+      }
+      break;
+   case CPacketControlInterface::CPacket::EType::PING:
+      /* same reply as CFirmware::HandlePing, with the virtual time */
+      if(!c_packet.HasData() || !(punRxData[0] & PING_FLAG_TIMESTAMPS)) {
+         m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::PING,
+                                              punRxData,
+                                              c_packet.GetDataLength());
+      }
+      else {
+         uint8_t punTxData[FRAGMENT_BUFFER_LENGTH + PING_TIMESTAMPS_SIZE];
+         uint8_t unTxDataLength = 0;
+         punTxData[unTxDataLength++] = punRxData[0];
+         unTxDataLength += PING_TIMESTAMPS_SIZE;
+         for(uint8_t unIdx = 1; unIdx < c_packet.GetDataLength(); unIdx++) {
+            punTxData[unTxDataLength++] = punRxData[unIdx];
+         }
+         /* the receive time is the arrival time of the frame, the transmit time the
+            virtual time of the main loop */
+         uint32_t punTimes[] = {c_packet.GetArrivalTime(), static_cast<uint32_t>(GetMicroseconds())};
+         for(uint8_t unIdx = 0; unIdx < PING_TIMESTAMPS_SIZE; unIdx++) {
+            punTxData[1 + unIdx] = (punTimes[unIdx / 4] >> (24 - 8 * (unIdx % 4))) & 0xFF;
+         }
+         m_cPacketControlInterface.SendPacket(CPacketControlInterface::CPacket::EType::PING,
+                                              punTxData,
+                                              unTxDataLength);
+      }
+      break;
+   default:
+      break;
+   }
+}
+
+/***********************************************************/
+/***********************************************************/
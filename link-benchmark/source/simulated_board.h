@@ -0,0 +1,70 @@
+#ifndef SIMULATED_BOARD_H
+#define SIMULATED_BOARD_H
+
+#include <deque>
+
+#include <packet_control_interface.h>
+
+#include <transport.h>
+
+/*
+ * Board simulated on the host, which runs the shared link layer of the firmwares
+ * (the UART interrupts, the frame receiver and the packet control interface) in
+ * virtual time. The UART moves one byte in each direction per byte time and the
+ * main loop runs once per byte time, taking no time itself unless a packet time is
+ * set. The main loop answers the PING, SET_LINK_OPTIONS and GET_LINK_STATS packets
+ * like the firmwares. Like firmware-sensact, it also keeps the speed set by
+ * SET_DDS_SPEED, executes scheduled commands and stops at once on a zero speed.
+ */
+class CSimulatedBoard : public CTransport {
+public:
+   CSimulatedBoard(uint32_t un_baud_rate);
+
+   void Write(const uint8_t* pun_data, size_t un_length);
+
+   size_t Read(uint8_t* pun_data, size_t un_length, uint32_t un_timeout_us);
+
+   uint64_t GetMicroseconds() {
+      return m_unTime / 1000;
+   }
+
+   /* Time the main loop takes to execute a packet, the frames received meanwhile
+      are queued */
+   void SetPacketTime(uint32_t un_packet_time_us) {
+      m_unPacketTime = static_cast<uint64_t>(un_packet_time_us) * 1000;
+   }
+
+private:
+   /* Stops the simulated differential drive system from the receive interrupt */
+   class CEmergencyStopHandler : public CPacketControlInterface::CUrgentPacketHandler {
+   public:
+      CEmergencyStopHandler(uint8_t* pun_speed) :
+         m_punSpeed(pun_speed) {}
+
+      bool HandleUrgentPacket(const CPacketControlInterface::CPacket& c_packet);
+
+   private:
+      uint8_t* m_punSpeed;
+   };
+
+   /* advances the virtual time by one byte time */
+   void Step();
+
+   void ExecutePacket(const CPacketControlInterface::CPacket& c_packet);
+
+   CPacketControlInterface m_cPacketControlInterface;
+   /* virtual time and duration of a byte with a start and a stop bit, in nanoseconds */
+   uint64_t m_unTime;
+   uint64_t m_unByteTime;
+   /* time the main loop takes to execute a packet and the end of the current one */
+   uint64_t m_unPacketTime;
+   uint64_t m_unBusyTime;
+   /* left and right speed of the differential drive system as in SET_DDS_SPEED */
+   uint8_t m_punSpeed[4];
+   CEmergencyStopHandler m_cEmergencyStopHandler;
+   /* bytes on the wire from the host to the board and from the board to the host */
+   std::deque<uint8_t> m_cRxBytes;
+   std::deque<uint8_t> m_cTxBytes;
+};
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Byte stream between the host and a board, with the time base of the measurements */
+class CTransport {
+public:
+   virtual ~CTransport() {}
+
+   virtual void Write(const uint8_t* pun_data, size_t un_length) = 0;
+
+   /* Reads up to un_length bytes, waiting at most un_timeout_us for the first one.
+      Returns the number of bytes read */
+   virtual size_t Read(uint8_t* pun_data, size_t un_length, uint32_t un_timeout_us) = 0;
+
+   virtual uint64_t GetMicroseconds() = 0;
+};
+
+#endif